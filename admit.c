@@ -0,0 +1,156 @@
+/*
+ * admit.c - Admission control: per-client connection limits and
+ *     CoDel-style load shedding on the work queue
+ */
+#include "csapp.h"
+#include <limits.h>
+#include "admit.h"
+#include "lockprof.h"
+
+/*********************************
+ * Per-client connection limits
+ *********************************/
+
+/* ip_key - Reduce a socket address to a 16-byte IPv6 (or mapped) key */
+static void ip_key(const struct sockaddr_storage *addr, unsigned char *key)
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+    memset(key, 0, 16);
+    if (addr->ss_family == AF_INET6)
+	memcpy(key, &sin6->sin6_addr, 16);
+    else if (addr->ss_family == AF_INET) {
+	key[10] = key[11] = 0xff;
+	memcpy(key + 12, &sin->sin_addr, 4);
+    }
+}
+
+static ipcount_t **ip_bucket(iplimit_t *lp, const unsigned char *key)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 16; i++)
+	h = (h ^ key[i]) * 16777619u;
+    return &lp->buckets[h % IPLIMIT_NBUCKETS];
+}
+
+/*
+ * iplimit_init - Allow at most max open connections per client address
+ *     (no limit if max is 0)
+ */
+void iplimit_init(iplimit_t *lp, int max)
+{
+    pthread_mutex_init(&lp->mutex, NULL);
+    memset(lp->buckets, 0, sizeof(lp->buckets));
+    lp->max = max;
+}
+
+/*
+ * iplimit_acquire - Count a new connection from addr. Returns 0 if it
+ *     may proceed, -1 if addr is at its limit (nothing is counted then).
+ */
+int iplimit_acquire(iplimit_t *lp, const struct sockaddr_storage *addr)
+{
+    unsigned char key[16];
+    ipcount_t **bp, *ip;
+    int rc = 0;
+
+    if (lp->max <= 0)
+	return 0;
+    ip_key(addr, key);
+    MUTEX_LOCK(&lp->mutex);
+    bp = ip_bucket(lp, key);
+    for (ip = *bp; ip && memcmp(ip->addr, key, 16); ip = ip->next)
+	;
+    if (!ip) {
+	ip = Malloc(sizeof(ipcount_t));
+	memcpy(ip->addr, key, 16);
+	ip->count = 0;
+	ip->next = *bp;
+	*bp = ip;
+    }
+    if (ip->count >= lp->max)
+	rc = -1;
+    else
+	ip->count++;
+    MUTEX_UNLOCK(&lp->mutex);
+    return rc;
+}
+
+/*
+ * iplimit_release - Uncount a connection admitted by iplimit_acquire
+ */
+void iplimit_release(iplimit_t *lp, const struct sockaddr_storage *addr)
+{
+    unsigned char key[16];
+    ipcount_t **pp, *ip;
+
+    if (lp->max <= 0)
+	return;
+    ip_key(addr, key);
+    MUTEX_LOCK(&lp->mutex);
+    for (pp = ip_bucket(lp, key); (ip = *pp) != NULL; pp = &ip->next)
+	if (!memcmp(ip->addr, key, 16))
+	    break;
+    if (ip && --ip->count == 0) {
+	*pp = ip->next;
+	Free(ip);
+    }
+    MUTEX_UNLOCK(&lp->mutex);
+}
+
+/*********************************
+ * Queue-delay controller
+ *********************************/
+
+/*
+ * The controller follows CoDel's rule for telling a good queue from a
+ * bad one: a queue is only bad if its delay stayed above target for a
+ * whole interval. While the previous interval was good, a connection
+ * is admitted unless it has waited longer than a full interval, which
+ * absorbs bursts. Once an interval ends with every delay above target,
+ * the queue is standing, and connections that waited longer than
+ * target are shed with a fast 503 until the delay drains again. Work
+ * that nobody is waiting for any more is not done, and the rest of the
+ * queue gets served within its deadlines.
+ */
+
+/*
+ * codel_init - Shed connections whose queue delay stays above target
+ *     milliseconds for longer than interval milliseconds
+ */
+void codel_init(codel_t *cp, unsigned long target, unsigned long interval)
+{
+    pthread_mutex_init(&cp->mutex, NULL);
+    cp->target = target;
+    cp->interval = interval;
+    cp->interval_end = 0;
+    cp->min_delay = ULONG_MAX;
+    cp->overloaded = 0;
+    cp->shed = 0;
+}
+
+/*
+ * codel_admit - Decide on a connection leaving the queue at time now
+ *     (ms) after waiting delay ms. Returns 1 to serve it, 0 to shed it.
+ */
+int codel_admit(codel_t *cp, unsigned long delay, unsigned long now)
+{
+    int admit;
+
+    MUTEX_LOCK(&cp->mutex);
+    if (now >= cp->interval_end) {
+	cp->overloaded = cp->interval_end && cp->min_delay > cp->target;
+	cp->min_delay = ULONG_MAX;
+	cp->interval_end = now + cp->interval;
+    }
+    if (delay < cp->min_delay)
+	cp->min_delay = delay;
+    admit = delay <= (cp->overloaded ? cp->target : cp->interval);
+    if (!admit)
+	cp->shed++;
+    MUTEX_UNLOCK(&cp->mutex);
+    return admit;
+}
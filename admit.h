@@ -0,0 +1,43 @@
+/*
+ * admit.h - Admission control: per-client connection limits and
+ *     CoDel-style load shedding on the work queue
+ */
+#ifndef __ADMIT_H__
+#define __ADMIT_H__
+
+#include "csapp.h"
+
+#define IPLIMIT_NBUCKETS 1024
+
+/* Open connections per client address */
+typedef struct ipcount {
+    unsigned char addr[16];          /* IPv4 (mapped) or IPv6 address */
+    int count;                       /* Connections currently open */
+    struct ipcount *next;            /* Hash chain */
+} ipcount_t;
+
+typedef struct {
+    pthread_mutex_t mutex;           /* Protects the table */
+    ipcount_t *buckets[IPLIMIT_NBUCKETS];
+    int max;                         /* Per-address limit, 0 for none */
+} iplimit_t;
+
+/* Queue-delay controller */
+typedef struct {
+    pthread_mutex_t mutex;           /* Protects everything below */
+    unsigned long target;            /* Acceptable standing delay, ms */
+    unsigned long interval;          /* Measurement interval, ms */
+    unsigned long interval_end;      /* When the current interval ends */
+    unsigned long min_delay;         /* Lowest delay seen this interval */
+    int overloaded;                  /* Last interval never got below target */
+    unsigned long shed;              /* Connections rejected so far */
+} codel_t;
+
+void iplimit_init(iplimit_t *lp, int max);
+int iplimit_acquire(iplimit_t *lp, const struct sockaddr_storage *addr);
+void iplimit_release(iplimit_t *lp, const struct sockaddr_storage *addr);
+
+void codel_init(codel_t *cp, unsigned long target, unsigned long interval);
+int codel_admit(codel_t *cp, unsigned long delay, unsigned long now);
+
+#endif /* __ADMIT_H__ */
@@ -0,0 +1,198 @@
+/*
+ * alog.c - Binary access log with per-thread rings and a writer thread
+ *
+ * Every thread that logs owns a single-producer, single-consumer ring
+ * of fixed-size records, so alog_write() is a copy and a release store:
+ * no lock, no system call, no formatting. One writer thread wakes every
+ * ALOG_FLUSH_MS, drains all rings into a batch and writes it with one
+ * write() per ALOG_BATCH records. When a ring is full the record is
+ * dropped rather than making the request wait.
+ *
+ * A log file is ALOG_MAGIC followed by records. With a size limit, a
+ * full file is rotated to path.1, path.1 to path.2 and so on up to
+ * path.ALOG_NKEEP, and a fresh file is started.
+ */
+#include "csapp.h"
+#include "alog.h"
+
+#define ALOG_RINGSIZE 1024           /* Records per thread, a power of 2 */
+#define ALOG_BATCH    256            /* Records per write() */
+#define ALOG_FLUSH_MS 50             /* Writer wakeup period */
+#define ALOG_NKEEP    4              /* Rotated files kept */
+
+typedef struct alog_ring {
+    alog_rec_t recs[ALOG_RINGSIZE];
+    unsigned long head __attribute__((aligned(64)));  /* Producer's */
+    unsigned long tail __attribute__((aligned(64)));  /* Writer's */
+    struct alog_ring *next;          /* Registry of all rings */
+} alog_ring_t;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alog_ring_t *registry;        /* Every thread's ring */
+static __thread alog_ring_t *myring; /* This thread's ring */
+
+static char *logpath;                /* NULL while logging is off */
+static size_t logmax;                /* Rotate beyond this, 0 for never */
+static size_t logsize;               /* Bytes in the current file */
+static int logfd = -1;
+
+/* log_create - Start a new, empty log file at logpath */
+static int log_create(void)
+{
+    if ((logfd = open(logpath, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644)) < 0)
+	return -1;
+    if (rio_writen(logfd, ALOG_MAGIC, ALOG_MAGICLEN) < 0) {
+	close(logfd);
+	logfd = -1;
+	return -1;
+    }
+    logsize = ALOG_MAGICLEN;
+    return 0;
+}
+
+/* log_rotate - Shift path.N to path.N+1, path to path.1, start afresh */
+static void log_rotate(void)
+{
+    char from[MAXLINE], to[MAXLINE];
+    int i;
+
+    close(logfd);
+    for (i = ALOG_NKEEP - 1; i >= 1; i--) {
+	snprintf(from, MAXLINE, "%s.%d", logpath, i);
+	snprintf(to, MAXLINE, "%s.%d", logpath, i + 1);
+	rename(from, to);
+    }
+    snprintf(to, MAXLINE, "%s.1", logpath);
+    rename(logpath, to);
+    if (log_create() < 0)
+	fprintf(stderr, "alog: can't reopen %s: %s\n", logpath,
+		strerror(errno));
+}
+
+/* log_append - Write n bytes of records, rotating first if needed */
+static void log_append(char *buf, size_t n)
+{
+    if (logmax && logsize > ALOG_MAGICLEN && logsize + n > logmax)
+	log_rotate();
+    if (logfd < 0 && log_create() < 0)
+	return;
+    if (rio_writen(logfd, buf, n) < 0)
+	return;
+    logsize += n;
+}
+
+/*
+ * alog_drain - Move up to max pending records from the rings into
+ *     batch. Returns the number moved.
+ */
+static int alog_drain(alog_rec_t *batch, int max)
+{
+    alog_ring_t *rp;
+    unsigned long head, tail;
+    int n = 0;
+
+    pthread_mutex_lock(&registry_mutex);
+    for (rp = registry; rp && n < max; rp = rp->next) {
+	head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
+	for (tail = rp->tail; tail != head && n < max; tail++)
+	    batch[n++] = rp->recs[tail % ALOG_RINGSIZE];
+	__atomic_store_n(&rp->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return n;
+}
+
+/* alog_writer - Thread routine: drain the rings to the file forever */
+static void *alog_writer(void *vargp)
+{
+    alog_rec_t *batch = Malloc(ALOG_BATCH * sizeof(alog_rec_t));
+    int n;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+	usleep(ALOG_FLUSH_MS * 1000);
+	while ((n = alog_drain(batch, ALOG_BATCH)) > 0)
+	    log_append((char *)batch, n * sizeof(alog_rec_t));
+    }
+    return NULL;
+}
+
+/*
+ * alog_open - Start logging to path, rotating when a file would grow
+ *     past maxsize bytes (0 for no limit). Returns -1 if the file can't
+ *     be created.
+ */
+int alog_open(const char *path, size_t maxsize)
+{
+    pthread_t tid;
+
+    logpath = strdup(path);
+    logmax = maxsize;
+    if (log_create() < 0) {
+	free(logpath);
+	logpath = NULL;
+	return -1;
+    }
+    Pthread_create(&tid, NULL, alog_writer, NULL);
+    return 0;
+}
+
+/* alog_enabled - Nonzero once alog_open() has succeeded */
+int alog_enabled(void)
+{
+    return logpath != NULL;
+}
+
+/* alog_setclient - Fill in the client address fields of rec */
+void alog_setclient(alog_rec_t *rec, const struct sockaddr_storage *addr)
+{
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+    rec->family = addr->ss_family;
+    memset(rec->addr, 0, sizeof(rec->addr));
+    if (addr->ss_family == AF_INET6) {
+	memcpy(rec->addr, &sin6->sin6_addr, 16);
+	rec->port = ntohs(sin6->sin6_port);
+    }
+    else {
+	memcpy(rec->addr, &sin->sin_addr, 4);
+	rec->port = ntohs(sin->sin_port);
+    }
+}
+
+/* alog_seturl - Copy url into rec, truncating it to fit */
+void alog_seturl(alog_rec_t *rec, const char *url)
+{
+    size_t len = strlen(url);
+
+    if (len >= ALOG_URLLEN) {
+	len = ALOG_URLLEN - 1;
+	rec->flags |= ALOG_TRUNC;
+    }
+    memcpy(rec->url, url, len);
+    rec->url[len] = '\0';
+}
+
+/*
+ * alog_write - Queue rec for the writer thread without blocking.
+ *     Returns -1 if this thread's ring is full and rec was dropped.
+ */
+int alog_write(const alog_rec_t *rec)
+{
+    unsigned long head;
+
+    if (!myring) {
+	myring = Calloc(1, sizeof(alog_ring_t));
+	pthread_mutex_lock(&registry_mutex);
+	myring->next = registry;
+	registry = myring;
+	pthread_mutex_unlock(&registry_mutex);
+    }
+    head = myring->head;
+    if (head - __atomic_load_n(&myring->tail, __ATOMIC_ACQUIRE) >= ALOG_RINGSIZE)
+	return -1;
+    myring->recs[head % ALOG_RINGSIZE] = *rec;
+    __atomic_store_n(&myring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
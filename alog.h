@@ -0,0 +1,40 @@
+/*
+ * alog.h - Binary access log with per-thread rings and a writer thread
+ */
+#ifndef __ALOG_H__
+#define __ALOG_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define ALOG_MAGIC    "PXALOG1\n"    /* First 8 bytes of every log file */
+#define ALOG_MAGICLEN 8
+#define ALOG_RECSIZE  256            /* Bytes per record */
+#define ALOG_URLLEN   (ALOG_RECSIZE - 48)
+
+/* Record flags */
+#define ALOG_HIT      0x01           /* Served from the cache */
+#define ALOG_TRUNC    0x02           /* url was truncated */
+
+/* One completed request. Fixed size, host byte order */
+typedef struct {
+    uint64_t time_us;                /* Completion, us since the epoch */
+    uint32_t total_us;               /* Accept to completion */
+    uint32_t ttfb_us;                /* Origin first byte, 0 if none */
+    uint64_t bytes;                  /* Response bytes sent */
+    uint16_t status;                 /* Status sent, 0 if none */
+    uint8_t flags;                   /* ALOG_* */
+    uint8_t family;                  /* AF_INET or AF_INET6 */
+    uint16_t port;                   /* Client port */
+    uint8_t pad[2];
+    uint8_t addr[16];                /* Client address */
+    char url[ALOG_URLLEN];           /* Request URI, NUL-terminated */
+} alog_rec_t;
+
+int alog_open(const char *path, size_t maxsize);
+int alog_enabled(void);
+void alog_setclient(alog_rec_t *rec, const struct sockaddr_storage *addr);
+void alog_seturl(alog_rec_t *rec, const char *url);
+int alog_write(const alog_rec_t *rec);
+
+#endif /* __ALOG_H__ */
@@ -0,0 +1,404 @@
+/*
+ * cache.c - Sharded cache of web objects keyed by request URI
+ *
+ * The cache is split into nshards shards, each with its own lock,
+ * index, object list and an equal share of the total capacity, so
+ * that lookups of unrelated URIs do not contend. Which object to evict
+ * is up to the eviction policy: LRU (the default), FIFO or CLOCK.
+ * Objects are reference counted: cache_lookup() hands out a reference
+ * that the caller must drop with cache_release() once it has finished
+ * sending the data, and an object evicted while still in use is freed
+ * by its last reader.
+ *
+ * A shard's index is an open-addressing table of (hash, object)
+ * slots with Robin Hood probing: an insert takes the slot of any
+ * entry closer to its home slot than the new one is, which keeps
+ * probe sequences short and lets a lookup stop at the first entry
+ * closer to home than itself. A probe touches only the slot array;
+ * the full 64-bit hash acts as the fingerprint, and an object's URL
+ * is compared only when it matches.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "lockprof.h"
+
+#define CACHE_MINSLOTS 64   /* Initial index slots per shard */
+
+static void obj_free(cache_obj_t *obj)
+{
+    Free(obj);
+}
+
+/* obj_class - The MIME_* class of obj, unregistered types being other */
+static int obj_class(cache_obj_t *obj)
+{
+    return obj->mime ? obj->mime->class : MIME_OTHER;
+}
+
+/* url_mime - Registry entry for the extension of url's path, or NULL */
+static const mime_ent_t *url_mime(const char *url)
+{
+    const char *p = strstr(url, "://");
+
+    p = strchr(p ? p + 3 : url, '/');
+    return p ? mime_lookup(p) : NULL;
+}
+
+/* lru_unlink - Remove obj from its shard's LRU list */
+static void lru_unlink(cache_obj_t *obj)
+{
+    obj->prev->next = obj->next;
+    obj->next->prev = obj->prev;
+}
+
+/* lru_push - Put obj at the head (newest end) of shard sp's list */
+static void lru_push(cache_shard_t *sp, cache_obj_t *obj)
+{
+    obj->next = sp->lru.next;
+    obj->prev = &sp->lru;
+    sp->lru.next->prev = obj;
+    sp->lru.next = obj;
+}
+
+static cache_shard_t *shard_of(cache_t *cp, unsigned long hash)
+{
+    return &cp->shards[hash % cp->nshards];
+}
+
+/*
+ * Index
+ *
+ * The shard picks its slice of the cache with the low bits of the
+ * hash, so the home slot comes from higher ones.
+ */
+static size_t slot_home(cache_shard_t *sp, unsigned long hash)
+{
+    return (hash >> 16) & sp->mask;
+}
+
+/* slot_dist - How far slot i is past the home of the entry in it */
+static size_t slot_dist(cache_shard_t *sp, size_t i)
+{
+    return (i - slot_home(sp, sp->slots[i].hash)) & sp->mask;
+}
+
+/* index_find - The object for url in sp's index, or NULL */
+static cache_obj_t *index_find(cache_shard_t *sp, unsigned long hash,
+			       const char *url)
+{
+    size_t i = slot_home(sp, hash), d;
+    cache_slot_t *s;
+
+    for (d = 0; ; d++, i = (i + 1) & sp->mask) {
+	s = &sp->slots[i];
+	if (!s->obj || slot_dist(sp, i) < d)
+	    return NULL;
+	if (s->hash == hash && !strcmp(s->obj->url, url))
+	    return s->obj;
+    }
+}
+
+/* index_put - Add obj, which is not in the index, to sp's index */
+static void index_put(cache_shard_t *sp, cache_obj_t *obj)
+{
+    cache_slot_t cur, tmp;
+    size_t i, d, sd;
+
+    cur.hash = obj->hash;
+    cur.obj = obj;
+    for (i = slot_home(sp, cur.hash), d = 0; sp->slots[i].obj;
+	 i = (i + 1) & sp->mask, d++) {
+	if ((sd = slot_dist(sp, i)) < d) {   /* Take from the rich */
+	    tmp = sp->slots[i];
+	    sp->slots[i] = cur;
+	    cur = tmp;
+	    d = sd;
+	}
+    }
+    sp->slots[i] = cur;
+}
+
+/* index_del - Remove obj from sp's index, shifting later entries back */
+static void index_del(cache_shard_t *sp, cache_obj_t *obj)
+{
+    size_t i = slot_home(sp, obj->hash), j;
+
+    while (sp->slots[i].obj != obj)
+	i = (i + 1) & sp->mask;
+    for (j = (i + 1) & sp->mask; sp->slots[j].obj && slot_dist(sp, j) > 0;
+	 i = j, j = (j + 1) & sp->mask)
+	sp->slots[i] = sp->slots[j];
+    sp->slots[i].obj = NULL;
+}
+
+/* index_grow - Double sp's index, keeping the load below 7/8 */
+static void index_grow(cache_shard_t *sp)
+{
+    cache_slot_t *old = sp->slots;
+    size_t i, n = sp->mask + 1;
+
+    sp->slots = Calloc(2 * n, sizeof(cache_slot_t));
+    sp->mask = 2 * n - 1;
+    for (i = 0; i < n; i++)
+	if (old[i].obj)
+	    index_put(sp, old[i].obj);
+    Free(old);
+}
+
+/*
+ * Eviction policies
+ *
+ * LRU moves a hit object to the head and evicts from the tail. FIFO
+ * never reorders. CLOCK (second-chance FIFO) marks a hit object and,
+ * looking for a victim, moves marked objects from the tail back to
+ * the head with their mark cleared, so a hit costs no list update.
+ */
+static void lru_hit(cache_shard_t *sp, cache_obj_t *obj)
+{
+    lru_unlink(obj);
+    lru_push(sp, obj);
+}
+
+static cache_obj_t *tail_victim(cache_shard_t *sp)
+{
+    return sp->lru.prev;
+}
+
+static void fifo_hit(cache_shard_t *sp, cache_obj_t *obj)
+{
+}
+
+static void clock_insert(cache_shard_t *sp, cache_obj_t *obj)
+{
+    obj->ref = 0;
+    lru_push(sp, obj);
+}
+
+static void clock_hit(cache_shard_t *sp, cache_obj_t *obj)
+{
+    obj->ref = 1;
+}
+
+static cache_obj_t *clock_victim(cache_shard_t *sp)
+{
+    cache_obj_t *obj;
+
+    while ((obj = sp->lru.prev)->ref) {
+	obj->ref = 0;
+	lru_unlink(obj);
+	lru_push(sp, obj);
+    }
+    return obj;
+}
+
+static const cache_policy_t lru_policy = { "lru", lru_push, lru_hit,
+					   tail_victim };
+static const cache_policy_t fifo_policy = { "fifo", lru_push, fifo_hit,
+					    tail_victim };
+static const cache_policy_t clock_policy = { "clock", clock_insert, clock_hit,
+					     clock_victim };
+
+const cache_policy_t *cache_policies[] = {
+    &lru_policy, &fifo_policy, &clock_policy, NULL
+};
+
+/* evict - Drop the object of shard sp that its policy picks */
+static void evict(cache_shard_t *sp)
+{
+    cache_obj_t *obj = sp->policy->victim(sp);
+
+    index_del(sp, obj);
+    lru_unlink(obj);
+    sp->size -= obj->size;
+    sp->nobjs--;
+    sp->evictions++;
+    sp->evictbytes += obj->size;
+    sp->classbytes[obj_class(obj)] -= obj->size;
+    if (--obj->refcnt == 0)
+	obj_free(obj);
+}
+
+/*
+ * cache_hash - 64-bit FNV-1a hash of string s
+ */
+unsigned long cache_hash(const char *s)
+{
+    unsigned long h = 14695981039346656037UL;
+
+    while (*s) {
+	h ^= (unsigned char)*s++;
+	h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/*
+ * cache_init - Create an empty cache holding at most maxsize bytes of
+ *     objects, none larger than maxobj, spread over nshards shards
+ */
+void cache_init(cache_t *cp, size_t maxsize, size_t maxobj, int nshards)
+{
+    int i;
+    cache_shard_t *sp;
+
+    cp->shards = Calloc(nshards, sizeof(cache_shard_t));
+    cp->nshards = nshards;
+    cp->maxobj = maxobj;
+    for (i = 0; i < nshards; i++) {
+	sp = &cp->shards[i];
+	pthread_mutex_init(&sp->mutex, NULL);
+	sp->slots = Calloc(CACHE_MINSLOTS, sizeof(cache_slot_t));
+	sp->mask = CACHE_MINSLOTS - 1;
+	sp->lru.next = sp->lru.prev = &sp->lru;
+	sp->policy = &lru_policy;
+	sp->maxsize = maxsize / nshards;
+    }
+}
+
+/*
+ * cache_deinit - Free every object and the cache itself. No references
+ *     may be outstanding.
+ */
+void cache_deinit(cache_t *cp)
+{
+    int i;
+    cache_shard_t *sp;
+
+    for (i = 0; i < cp->nshards; i++) {
+	sp = &cp->shards[i];
+	while (sp->lru.next != &sp->lru)
+	    evict(sp);
+	Free(sp->slots);
+	pthread_mutex_destroy(&sp->mutex);
+    }
+    Free(cp->shards);
+}
+
+/*
+ * cache_setpolicy - Switch the eviction policy of an empty cache to
+ *     the one called name. Returns -1 if there is no such policy.
+ */
+int cache_setpolicy(cache_t *cp, const char *name)
+{
+    const cache_policy_t **pp;
+    int i;
+
+    for (pp = cache_policies; *pp; pp++)
+	if (!strcmp((*pp)->name, name))
+	    break;
+    if (!*pp)
+	return -1;
+    for (i = 0; i < cp->nshards; i++)
+	cp->shards[i].policy = *pp;
+    return 0;
+}
+
+/*
+ * cache_lookup - Return a referenced object for url and tell the
+ *     policy it was used, or NULL on a miss
+ */
+cache_obj_t *cache_lookup(cache_t *cp, const char *url)
+{
+    unsigned long hash = cache_hash(url);
+    cache_shard_t *sp = shard_of(cp, hash);
+    cache_obj_t *obj;
+
+    MUTEX_LOCK(&sp->mutex);
+    if ((obj = index_find(sp, hash, url)) != NULL) {
+	sp->policy->hit(sp, obj);
+	obj->refcnt++;
+	sp->hits++;
+	sp->hitbytes += obj->size;
+    }
+    else
+	sp->misses++;
+    MUTEX_UNLOCK(&sp->mutex);
+    return obj;
+}
+
+/*
+ * cache_release - Drop a reference obtained from cache_lookup
+ */
+void cache_release(cache_t *cp, cache_obj_t *obj)
+{
+    cache_shard_t *sp = shard_of(cp, obj->hash);
+    int refcnt;
+
+    MUTEX_LOCK(&sp->mutex);
+    refcnt = --obj->refcnt;
+    MUTEX_UNLOCK(&sp->mutex);
+    if (refcnt == 0)
+	obj_free(obj);
+}
+
+/*
+ * cache_insert - Copy size bytes of data into the cache under url,
+ *     evicting objects chosen by the policy to make room. Returns 0 on
+ *     success, -1 if the object is too large or url is already cached.
+ */
+int cache_insert(cache_t *cp, const char *url, const char *data, size_t size)
+{
+    unsigned long hash = cache_hash(url);
+    cache_shard_t *sp = shard_of(cp, hash);
+    size_t ulen = strlen(url) + 1;
+    cache_obj_t *obj;
+
+    if (size > cp->maxobj || size > sp->maxsize)
+	return -1;
+
+    /* Build the object before taking the lock */
+    obj = Malloc(sizeof(cache_obj_t) + ulen + size);
+    memcpy(obj->url, url, ulen);
+    obj->hash = hash;
+    obj->data = obj->url + ulen;
+    memcpy(obj->data, data, size);
+    obj->size = size;
+    obj->refcnt = 1;
+    obj->ref = 0;
+    obj->mime = url_mime(url);
+
+    MUTEX_LOCK(&sp->mutex);
+    if (index_find(sp, hash, url)) {   /* Lost a race with another miss */
+	MUTEX_UNLOCK(&sp->mutex);
+	obj_free(obj);
+	return -1;
+    }
+    while (sp->size + size > sp->maxsize)
+	evict(sp);
+    if ((sp->nobjs + 1) * 8 > (sp->mask + 1) * 7)
+	index_grow(sp);
+    index_put(sp, obj);
+    sp->policy->insert(sp, obj);
+    sp->size += size;
+    sp->classbytes[obj_class(obj)] += size;
+    sp->nobjs++;
+    sp->inserts++;
+    MUTEX_UNLOCK(&sp->mutex);
+    return 0;
+}
+
+/*
+ * cache_stats - Sum the counters of every shard into *st
+ */
+void cache_stats(cache_t *cp, cache_stats_t *st)
+{
+    int i, c;
+    cache_shard_t *sp;
+
+    memset(st, 0, sizeof(cache_stats_t));
+    for (i = 0; i < cp->nshards; i++) {
+	sp = &cp->shards[i];
+	MUTEX_LOCK(&sp->mutex);
+	st->hits += sp->hits;
+	st->misses += sp->misses;
+	st->hitbytes += sp->hitbytes;
+	st->inserts += sp->inserts;
+	st->evictions += sp->evictions;
+	st->evictbytes += sp->evictbytes;
+	st->size += sp->size;
+	st->nobjs += sp->nobjs;
+	for (c = 0; c < MIME_NCLASSES; c++)
+	    st->classbytes[c] += sp->classbytes[c];
+	MUTEX_UNLOCK(&sp->mutex);
+    }
+}
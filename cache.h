@@ -0,0 +1,89 @@
+/*
+ * cache.h - Sharded cache of web objects keyed by request URI, with a
+ *     pluggable eviction policy (LRU by default)
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+#include "mime.h"
+
+/*
+ * A cached web object, allocated in one block with its key and data.
+ * Readers hold a reference while they use it.
+ */
+typedef struct cache_obj {
+    unsigned long hash;              /* Hash of url */
+    char *data;                      /* Raw response, headers and body */
+    size_t size;                     /* Bytes in data */
+    int refcnt;                      /* Readers, plus one while cached */
+    int ref;                         /* Referenced since last considered */
+    const mime_ent_t *mime;          /* Type by URL extension, or NULL */
+    struct cache_obj *prev, *next;   /* Policy's list, newest first */
+    char url[];                      /* Key: absolute request URI */
+} cache_obj_t;
+
+/* A slot of a shard's index: an object and its hash, or empty */
+typedef struct {
+    unsigned long hash;
+    cache_obj_t *obj;                /* NULL if the slot is empty */
+} cache_slot_t;
+
+struct cache_shard;
+
+/*
+ * An eviction policy. Each shard keeps its objects on one list; the
+ * policy decides where new and hit objects go and which one to evict.
+ * All three run with the shard locked.
+ */
+typedef struct {
+    const char *name;
+    void (*insert)(struct cache_shard *sp, cache_obj_t *obj);
+    void (*hit)(struct cache_shard *sp, cache_obj_t *obj);
+    cache_obj_t *(*victim)(struct cache_shard *sp);
+} cache_policy_t;
+
+extern const cache_policy_t *cache_policies[];  /* NULL-terminated */
+
+/* One independently locked slice of the cache */
+typedef struct cache_shard {
+    pthread_mutex_t mutex;           /* Protects everything below */
+    cache_slot_t *slots;             /* Robin Hood index of objects */
+    size_t mask;                     /* Slots - 1, slots a power of 2 */
+    cache_obj_t lru;                 /* Sentinel of the policy's list */
+    const cache_policy_t *policy;
+    size_t size;                     /* Bytes cached in this shard */
+    size_t maxsize;                  /* Capacity of this shard */
+    int nobjs;                       /* Objects cached in this shard */
+    unsigned long hits, misses;      /* Lookups */
+    unsigned long hitbytes;          /* Bytes handed out on hits */
+    unsigned long inserts, evictions;
+    unsigned long evictbytes;        /* Bytes evicted */
+    size_t classbytes[MIME_NCLASSES];  /* Bytes cached by MIME_* class */
+} cache_shard_t;
+
+typedef struct {
+    cache_shard_t *shards;
+    int nshards;
+    size_t maxobj;                   /* Largest object worth caching */
+} cache_t;
+
+/* Counters summed over all shards */
+typedef struct {
+    unsigned long hits, misses, hitbytes;
+    unsigned long inserts, evictions, evictbytes;
+    size_t size;                     /* Bytes cached */
+    int nobjs;                       /* Objects cached */
+    size_t classbytes[MIME_NCLASSES];  /* Bytes cached by MIME_* class */
+} cache_stats_t;
+
+void cache_init(cache_t *cp, size_t maxsize, size_t maxobj, int nshards);
+void cache_deinit(cache_t *cp);
+cache_obj_t *cache_lookup(cache_t *cp, const char *url);
+void cache_release(cache_t *cp, cache_obj_t *obj);
+int cache_insert(cache_t *cp, const char *url, const char *data, size_t size);
+unsigned long cache_hash(const char *s);
+int cache_setpolicy(cache_t *cp, const char *name);
+void cache_stats(cache_t *cp, cache_stats_t *st);
+
+#endif /* __CACHE_H__ */
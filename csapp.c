@@ -792,14 +792,96 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_sendn - Robustly send n bytes on a socket (unbuffered). Unlike
+ *    rio_writen, a peer that has gone away makes it fail with EPIPE
+ *    instead of raising SIGPIPE.
+ */
+ssize_t rio_sendn(int fd, void *usrbuf, size_t n) 
+{
+    size_t nleft = n;
+    ssize_t nsent;
+    char *bufp = usrbuf;
 
-/* 
+    while (nleft > 0) {
+	if ((nsent = send(fd, bufp, nleft, MSG_NOSIGNAL)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nsent = 0;       /* and call send() again */
+	    else
+		return -1;       /* errno set by send() */
+	}
+	nleft -= nsent;
+	bufp += nsent;
+    }
+    return n;
+}
+
+
+/*
+ * The Rio buffer pool - Internal read buffers are attached to a rio_t
+ *    only while it holds unread bytes, and go back to a shared pool as
+ *    soon as it is drained. Buffers come in power-of-two size classes
+ *    from RIO_MINBUFSIZE to RIO_MAXBUFSIZE; each class keeps at most
+ *    RIO_POOLMAX idle buffers and frees the rest.
+ */
+#define RIO_NCLASSES 8   /* 512, 1K, ..., 64K */
+#define RIO_POOLMAX  64  /* Max idle buffers kept per class */
+
+static pthread_mutex_t rio_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void *rio_pool[RIO_NCLASSES];    /* Free lists, linked in place */
+static int rio_pool_cnt[RIO_NCLASSES];  /* Idle buffers in each list */
+
+/* rio_bufclass - Return the smallest size class holding size bytes */
+static int rio_bufclass(size_t size)
+{
+    int c = 0;
+
+    while (c < RIO_NCLASSES - 1 && ((size_t)RIO_MINBUFSIZE << c) < size)
+	c++;
+    return c;
+}
+
+/* rio_getbuf - Take a buffer of the class holding size bytes */
+static char *rio_getbuf(size_t size)
+{
+    int c = rio_bufclass(size);
+    void *buf;
+
+    pthread_mutex_lock(&rio_pool_mutex);
+    if ((buf = rio_pool[c]) != NULL) {
+	rio_pool[c] = *(void **)buf;
+	rio_pool_cnt[c]--;
+    }
+    pthread_mutex_unlock(&rio_pool_mutex);
+    if (!buf)
+	buf = malloc((size_t)RIO_MINBUFSIZE << c);
+    return buf;
+}
+
+/* rio_putbuf - Return a buffer obtained from rio_getbuf to the pool */
+static void rio_putbuf(char *buf, size_t size)
+{
+    int c = rio_bufclass(size);
+
+    pthread_mutex_lock(&rio_pool_mutex);
+    if (rio_pool_cnt[c] < RIO_POOLMAX) {
+	*(void **)buf = rio_pool[c];
+	rio_pool[c] = buf;
+	rio_pool_cnt[c]++;
+	buf = NULL;
+    }
+    pthread_mutex_unlock(&rio_pool_mutex);
+    free(buf);
+}
+
+/*
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
  *    buffer, where n is the number of bytes requested by the user and
  *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+ *    entry, rio_read() attaches a pooled buffer and refills it via a
+ *    call to read() if the internal buffer is empty. The buffer goes
+ *    back to the pool once it is drained or the read fails.
  */
 /* $begin rio_read */
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
@@ -807,25 +889,37 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
     int cnt;
 
     while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
+	if (!rp->rio_buf) {
+	    if (!(rp->rio_buf = rio_getbuf(rp->rio_wantsize))) {
+		errno = ENOMEM;
+		return -1;
+	    }
+	    rp->rio_bufsize = rp->rio_wantsize;
+	}
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_bufsize);
 	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* Interrupted by sig handler return */
+	    if (errno != EINTR) { /* Interrupted by sig handler return */
+		rio_readfreeb(rp);
 		return -1;
+	    }
 	}
-	else if (rp->rio_cnt == 0)  /* EOF */
+	else if (rp->rio_cnt == 0) { /* EOF */
+	    rio_readfreeb(rp);
 	    return 0;
-	else 
+	}
+	else
 	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
     }
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
-    cnt = n;          
-    if (rp->rio_cnt < n)   
+    cnt = n;
+    if (rp->rio_cnt < n)
 	cnt = rp->rio_cnt;
     memcpy(usrbuf, rp->rio_bufptr, cnt);
     rp->rio_bufptr += cnt;
     rp->rio_cnt -= cnt;
+    if (rp->rio_cnt == 0)  /* Drained: detach the buf while idle */
+	rio_readfreeb(rp);
     return cnt;
 }
 /* $end rio_read */
@@ -834,14 +928,52 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
  */
 /* $begin rio_readinitb */
-void rio_readinitb(rio_t *rp, int fd) 
+void rio_readinitb(rio_t *rp, int fd)
 {
-    rp->rio_fd = fd;  
-    rp->rio_cnt = 0;  
-    rp->rio_bufptr = rp->rio_buf;
+    rio_readinitbsz(rp, fd, RIO_BUFSIZE);
 }
 /* $end rio_readinitb */
 
+/*
+ * rio_readinitbsz - Like rio_readinitb, but refill through an internal
+ *    buffer of bufsize bytes (rounded up to a pool size class). No
+ *    memory is attached until the first read.
+ */
+void rio_readinitbsz(rio_t *rp, int fd, size_t bufsize)
+{
+    rp->rio_fd = fd;
+    rp->rio_cnt = 0;
+    rp->rio_buf = NULL;
+    rp->rio_bufptr = NULL;
+    rp->rio_bufsize = 0;
+    rio_setbufsize(rp, bufsize);
+}
+
+/*
+ * rio_setbufsize - Change the internal buffer size used by later
+ *    refills, e.g. to switch from header reads to bulk relay. Bytes
+ *    that are already buffered stay put until they are consumed.
+ */
+void rio_setbufsize(rio_t *rp, size_t bufsize)
+{
+    rp->rio_wantsize = (size_t)RIO_MINBUFSIZE << rio_bufclass(bufsize);
+}
+
+/*
+ * rio_readfreeb - Detach the internal buffer and return it to the pool,
+ *    discarding any unread bytes. Must be called before a rio_t that
+ *    may still hold buffered data is discarded.
+ */
+void rio_readfreeb(rio_t *rp)
+{
+    if (rp->rio_buf) {
+	rio_putbuf(rp->rio_buf, rp->rio_bufsize);
+	rp->rio_buf = NULL;
+	rp->rio_bufptr = NULL;
+    }
+    rp->rio_cnt = 0;
+}
+
 /*
  * rio_readnb - Robustly read n bytes (buffered)
  */
@@ -853,9 +985,17 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) 
+	if (rp->rio_cnt <= 0 && nleft >= rp->rio_wantsize) {
+	    /* Large read on an empty buf: bypass it and read directly */
+	    if ((nread = read(rp->rio_fd, bufp, nleft)) < 0) {
+		if (errno != EINTR) /* Interrupted by sig handler return */
+		    return -1;      /* errno set by read() */
+		continue;           /* and call read() again */
+	    }
+	}
+	else if ((nread = rio_read(rp, bufp, nleft)) < 0) 
             return -1;          /* errno set by read() */ 
-	else if (nread == 0)
+	if (nread == 0)
 	    break;              /* EOF */
 	nleft -= nread;
 	bufp += nread;
@@ -864,6 +1004,22 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 }
 /* $end rio_readnb */
 
+/*
+ * rio_readb - Read up to n bytes (buffered), returning as soon as any
+ *    are available rather than waiting for all n
+ */
+ssize_t rio_readb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t nread;
+
+    if (rp->rio_cnt > 0 || n < rp->rio_wantsize)
+	return rio_read(rp, usrbuf, n);
+    while ((nread = read(rp->rio_fd, usrbuf, n)) < 0)
+	if (errno != EINTR) /* Interrupted by sig handler return */
+	    return -1;      /* errno set by read() */
+    return nread;
+}
+
 /* 
  * rio_readlineb - Robustly read a text line (buffered)
  */
@@ -42,12 +42,16 @@ typedef struct sockaddr SA;
 
 /* Persistent state for the robust I/O (Rio) package */
 /* $begin rio_t */
-#define RIO_BUFSIZE 8192
+#define RIO_BUFSIZE    8192    /* Default internal buf size */
+#define RIO_MINBUFSIZE 512     /* Smallest pooled buf (header reads) */
+#define RIO_MAXBUFSIZE 65536   /* Largest pooled buf (bulk relay) */
 typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer, NULL while idle */
+    size_t rio_bufsize;        /* Size of internal buf while attached */
+    size_t rio_wantsize;       /* Size of the next buf to attach */
 } rio_t;
 /* $end rio_t */
 
@@ -175,8 +179,13 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_sendn(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitbsz(rio_t *rp, int fd, size_t bufsize);
+void rio_setbufsize(rio_t *rp, size_t bufsize);
+void rio_readfreeb(rio_t *rp);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t	rio_readb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
 /* Wrappers for Rio package */
@@ -0,0 +1,230 @@
+/*
+ * http.c - HTTP/1.x request parsing helpers for the proxy
+ *
+ * All output buffers are assumed to hold at least MAXLINE bytes, and
+ * every function returns 0 on success and -1 on malformed input unless
+ * noted otherwise.
+ */
+#include "csapp.h"
+#include "http.h"
+
+/*
+ * parse_requestline - Split "METHOD URI HTTP/x.y\r\n" into its parts
+ */
+int parse_requestline(const char *line, char *method, char *uri, char *version)
+{
+    if (sscanf(line, "%s %s %s", method, uri, version) != 3)
+	return -1;
+    if (strncmp(version, "HTTP/1.", 7))
+	return -1;
+    return 0;
+}
+
+/*
+ * parse_uri - Split an absolute "http://host[:port][/path]" URI. An
+ *     IPv6 literal host is written as "[addr]" and returned without
+ *     the brackets. The port defaults to 80 and the path to "/".
+ */
+int parse_uri(const char *uri, char *host, char *port, char *path)
+{
+    const char *hostp, *hostend, *p;
+    size_t len;
+
+    if (strncasecmp(uri, "http://", 7))
+	return -1;
+    hostp = uri + 7;
+
+    /* Find the end of the host */
+    if (*hostp == '[') {
+	if (!(hostend = strchr(++hostp, ']')))
+	    return -1;
+	p = hostend + 1;
+    }
+    else {
+	hostend = hostp + strcspn(hostp, ":/");
+	p = hostend;
+    }
+    if ((len = hostend - hostp) == 0 || len >= MAXLINE)
+	return -1;
+    memcpy(host, hostp, len);
+    host[len] = '\0';
+
+    /* Optional port */
+    if (*p == ':') {
+	len = strspn(++p, "0123456789");
+	if (len == 0 || len > 5)
+	    return -1;
+	memcpy(port, p, len);
+	port[len] = '\0';
+	p += len;
+    }
+    else
+	strcpy(port, HTTP_DEFPORT);
+
+    /* Path, if any */
+    if (*p == '\0')
+	strcpy(path, "/");
+    else if (*p == '/' && strlen(p) < MAXLINE)
+	strcpy(path, p);
+    else
+	return -1;
+    return 0;
+}
+
+/*
+ * parse_header - Split a "Name: value\r\n" header line into name and
+ *     value, dropping the line terminator and the blanks around value
+ */
+int parse_header(const char *line, char *name, char *value)
+{
+    const char *colon, *p, *end;
+    size_t len;
+
+    if (!(colon = strchr(line, ':')) || colon == line)
+	return -1;
+    len = colon - line;
+    memcpy(name, line, len);
+    name[len] = '\0';
+
+    for (p = colon + 1; *p == ' ' || *p == '\t'; p++)
+	;
+    for (end = p + strlen(p); end > p && isspace((unsigned char)end[-1]); end--)
+	;
+    len = end - p;
+    memcpy(value, p, len);
+    value[len] = '\0';
+    return 0;
+}
+
+/*
+ * parse_status - Return the status code from the first n bytes of a
+ *     response ("HTTP/x.y NNN ..."), or -1 if they do not start one
+ */
+int parse_status(const char *buf, size_t n)
+{
+    if (n < 12 || strncmp(buf, "HTTP/1.", 7) || buf[8] != ' ')
+	return -1;
+    if (!isdigit((unsigned char)buf[9]) || !isdigit((unsigned char)buf[10]) ||
+	!isdigit((unsigned char)buf[11]))
+	return -1;
+    return (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+}
+
+/*
+ * parse_hdrend - Return the offset of the body in the n-byte response
+ *     in buf, just past the blank line that ends its headers, or 0 if
+ *     buf holds no complete header block
+ */
+size_t parse_hdrend(const char *buf, size_t n)
+{
+    const char *p = buf, *end = buf + n;
+
+    while ((p = memchr(p, '\n', end - p)) != NULL && ++p < end) {
+	if (*p == '\n')
+	    return p + 1 - buf;
+	if (*p == '\r' && p + 1 < end && p[1] == '\n')
+	    return p + 2 - buf;
+    }
+    return 0;
+}
+
+/*
+ * find_header - Copy into value the value of the first header called
+ *     name in the n-byte response at buf. Returns -1 if it has none.
+ */
+int find_header(const char *buf, size_t n, const char *name, char *value)
+{
+    char line[MAXLINE], hname[MAXLINE];
+    const char *p, *eol, *end = buf + parse_hdrend(buf, n);
+
+    if (!(p = memchr(buf, '\n', end - buf)))   /* Past the status line */
+	return -1;
+    for (p++; p < end; p = eol + 1) {
+	eol = memchr(p, '\n', end - p);
+	if (eol - p >= MAXLINE)
+	    continue;
+	memcpy(line, p, eol - p + 1);
+	line[eol - p + 1] = '\0';
+	if (parse_header(line, hname, value) == 0 && !strcasecmp(hname, name))
+	    return 0;
+    }
+    return -1;
+}
+
+/*
+ * vary_only - Does every Vary header in the n-byte response at buf list
+ *     request header name alone? Returns 1 if so, or if it has none,
+ *     and 0 if it varies on anything else.
+ */
+int vary_only(const char *buf, size_t n, const char *name)
+{
+    char line[MAXLINE], hname[MAXLINE], value[MAXLINE], *tok, *save;
+    const char *p, *eol, *end = buf + parse_hdrend(buf, n);
+
+    if (!(p = memchr(buf, '\n', end - buf)))   /* Past the status line */
+	return 0;
+    for (p++; p < end; p = eol + 1) {
+	eol = memchr(p, '\n', end - p);
+	if (eol - p >= MAXLINE)
+	    return 0;
+	memcpy(line, p, eol - p + 1);
+	line[eol - p + 1] = '\0';
+	if (parse_header(line, hname, value) < 0 || strcasecmp(hname, "Vary"))
+	    continue;
+	for (tok = strtok_r(value, ", \t", &save); tok;
+	     tok = strtok_r(NULL, ", \t", &save))
+	    if (strcasecmp(tok, name))
+		return 0;
+    }
+    return 1;
+}
+
+/*
+ * parse_range - Resolve the value of a Range header against a body of
+ *     size bytes. Returns 1 with [*first, *last] set for one byte
+ *     range, -1 if that range can't be satisfied, and 0 if the header
+ *     should be ignored and the whole body sent: several ranges, or a
+ *     form this parser doesn't know, both of which HTTP allows a
+ *     server to ignore.
+ */
+int parse_range(const char *value, size_t size, size_t *first, size_t *last)
+{
+    unsigned long long a, b;
+    const char *p;
+    char *end;
+
+    if (strncasecmp(value, "bytes=", 6) || strchr(value, ','))
+	return 0;
+    p = value + 6;
+    if (*p == '-') {                 /* The last b bytes */
+	if (!isdigit((unsigned char)p[1]))
+	    return 0;
+	b = strtoull(p + 1, &end, 10);
+	if (*end)
+	    return 0;
+	if (b == 0 || size == 0)
+	    return -1;
+	*first = b < size ? size - b : 0;
+	*last = size - 1;
+	return 1;
+    }
+    if (!isdigit((unsigned char)*p))
+	return 0;
+    a = strtoull(p, &end, 10);
+    if (*end != '-')
+	return 0;
+    p = end + 1;
+    b = size;                        /* "a-": to the end */
+    if (*p) {
+	if (!isdigit((unsigned char)*p))
+	    return 0;
+	b = strtoull(p, &end, 10);
+	if (*end || b < a)
+	    return 0;
+    }
+    if (a >= size)
+	return -1;
+    *first = a;
+    *last = b < size ? b : size - 1;
+    return 1;
+}
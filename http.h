@@ -0,0 +1,20 @@
+/*
+ * http.h - HTTP/1.x request parsing helpers for the proxy
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "csapp.h"
+
+#define HTTP_DEFPORT "80"
+
+int parse_requestline(const char *line, char *method, char *uri, char *version);
+int parse_uri(const char *uri, char *host, char *port, char *path);
+int parse_header(const char *line, char *name, char *value);
+int parse_status(const char *buf, size_t n);
+size_t parse_hdrend(const char *buf, size_t n);
+int find_header(const char *buf, size_t n, const char *name, char *value);
+int vary_only(const char *buf, size_t n, const char *name);
+int parse_range(const char *value, size_t size, size_t *first, size_t *last);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,176 @@
+/*
+ * lockprof.c - Lock contention and queue-wait profiling
+ *
+ * Each acquire first tries the lock without blocking, so an
+ * uncontended acquire costs one extra clock read. Hold times are
+ * charged to the site that took the lock: each thread keeps a short
+ * stack of the locks it holds, with where and when it took them.
+ * Counters are shared between threads and updated atomically, which is
+ * itself a cost, so this is for profiling builds only.
+ */
+#include "csapp.h"
+#include "lockprof.h"
+
+#define LP_MAXHELD 8                 /* Locks one thread holds at once */
+
+typedef struct {
+    void *lock;
+    lpsite_t *site;
+    unsigned long since;
+} lpheld_t;
+
+static pthread_mutex_t sites_mutex = PTHREAD_MUTEX_INITIALIZER;
+static lpsite_t *sites;              /* Every site that has acquired */
+static __thread lpheld_t held[LP_MAXHELD];
+static __thread int nheld;
+
+static unsigned long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void update_max(unsigned long *p, unsigned long v)
+{
+    unsigned long old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (v > old && !__atomic_compare_exchange_n(p, &old, v, 0,
+		       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/* acquired - Account for an acquire at site that waited wait ns */
+static void acquired(lpsite_t *site, int contended, unsigned long wait)
+{
+    if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE)) {
+	pthread_mutex_lock(&sites_mutex);
+	if (!site->registered) {
+	    site->next = sites;
+	    sites = site;
+	    __atomic_store_n(&site->registered, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&sites_mutex);
+    }
+    __atomic_fetch_add(&site->acquires, 1, __ATOMIC_RELAXED);
+    if (contended) {
+	__atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&site->wait_ns, wait, __ATOMIC_RELAXED);
+	update_max(&site->wait_max, wait);
+    }
+}
+
+/* hold - Remember that this thread now holds lock, taken at site */
+static void hold(void *lock, lpsite_t *site)
+{
+    if (nheld < LP_MAXHELD) {
+	held[nheld].lock = lock;
+	held[nheld].site = site;
+	held[nheld].since = now_ns();
+	nheld++;
+    }
+}
+
+/* unhold - Charge the time lock was held to the site that took it */
+static void unhold(void *lock)
+{
+    unsigned long t;
+    int i;
+
+    for (i = nheld - 1; i >= 0; i--) {
+	if (held[i].lock != lock)
+	    continue;
+	t = now_ns() - held[i].since;
+	__atomic_fetch_add(&held[i].site->hold_ns, t, __ATOMIC_RELAXED);
+	update_max(&held[i].site->hold_max, t);
+	held[i] = held[--nheld];
+	return;
+    }
+}
+
+void lockprof_mutex_lock(lpsite_t *site, pthread_mutex_t *m)
+{
+    unsigned long start;
+
+    if (pthread_mutex_trylock(m) == 0)
+	acquired(site, 0, 0);
+    else {
+	start = now_ns();
+	pthread_mutex_lock(m);
+	acquired(site, 1, now_ns() - start);
+    }
+    hold(m, site);
+}
+
+void lockprof_mutex_unlock(pthread_mutex_t *m)
+{
+    unhold(m);
+    pthread_mutex_unlock(m);
+}
+
+/* lockprof_sem_wait - P(s), recording how long it blocked */
+void lockprof_sem_wait(lpsite_t *site, sem_t *s)
+{
+    unsigned long start;
+
+    if (sem_trywait(s) == 0)
+	acquired(site, 0, 0);
+    else {
+	start = now_ns();
+	P(s);
+	acquired(site, 1, now_ns() - start);
+    }
+}
+
+void lockprof_sem_lock(lpsite_t *site, sem_t *s)
+{
+    lockprof_sem_wait(site, s);
+    hold(s, site);
+}
+
+void lockprof_sem_unlock(sem_t *s)
+{
+    unhold(s);
+    V(s);
+}
+
+/*
+ * lockprof_json - Append a "locks" member listing every site, most
+ *     total wait first
+ */
+void lockprof_json(strbuf_t *sb)
+{
+    lpsite_t *site, **list;
+    int n = 0, i, j;
+
+    pthread_mutex_lock(&sites_mutex);
+    for (site = sites; site; site = site->next)
+	n++;
+    list = Malloc((n + 1) * sizeof(lpsite_t *));
+    for (site = sites, i = 0; site; site = site->next)
+	list[i++] = site;
+    pthread_mutex_unlock(&sites_mutex);
+
+    /* Insertion sort by wait time; there are a few dozen sites */
+    for (i = 1; i < n; i++) {
+	site = list[i];
+	for (j = i; j > 0 && list[j-1]->wait_ns < site->wait_ns; j--)
+	    list[j] = list[j-1];
+	list[j] = site;
+    }
+
+    strbuf_printf(sb, "\"locks\": [");
+    for (i = 0; i < n; i++) {
+	site = list[i];
+	strbuf_printf(sb, "%s\n  {\"site\": \"%s:%d\", \"lock\": \"%s\", "
+		      "\"acquires\": %lu, \"contended\": %lu, "
+		      "\"wait_ns\": %lu, \"wait_max_ns\": %lu, "
+		      "\"hold_ns\": %lu, \"hold_max_ns\": %lu}",
+		      i ? "," : "", site->file, site->line, site->lock,
+		      site->acquires, site->contended, site->wait_ns,
+		      site->wait_max, site->hold_ns, site->hold_max);
+    }
+    strbuf_printf(sb, "%s]", n ? "\n" : "");
+    Free(list);
+}
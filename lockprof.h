@@ -0,0 +1,57 @@
+/*
+ * lockprof.h - Lock contention and queue-wait profiling
+ *
+ * Shared locks and queue semaphores are taken through the macros
+ * below. In a normal build they are the plain pthread and P/V calls.
+ * Built with "make LOCKPROF=1", every call site records how often it
+ * acquired, how often it had to wait, how long it waited and how long
+ * it then held the lock; GET /__stats lists the sites.
+ *
+ *   MUTEX_LOCK/MUTEX_UNLOCK  a pthread mutex
+ *   SEM_LOCK/SEM_UNLOCK      a binary semaphore used as a mutex
+ *   SEM_WAIT                 P() on a counting semaphore (wait only)
+ */
+#ifndef __LOCKPROF_H__
+#define __LOCKPROF_H__
+
+#include "csapp.h"
+#include "stats.h"
+
+/* Counters for one acquiring call site */
+typedef struct lpsite {
+    const char *file;
+    int line;
+    const char *lock;                /* The lock expression, as written */
+    int registered;
+    unsigned long acquires, contended;
+    unsigned long wait_ns, wait_max; /* Time blocked before acquiring */
+    unsigned long hold_ns, hold_max; /* Time held, mutexes only */
+    struct lpsite *next;
+} lpsite_t;
+
+void lockprof_mutex_lock(lpsite_t *site, pthread_mutex_t *m);
+void lockprof_mutex_unlock(pthread_mutex_t *m);
+void lockprof_sem_lock(lpsite_t *site, sem_t *s);
+void lockprof_sem_unlock(sem_t *s);
+void lockprof_sem_wait(lpsite_t *site, sem_t *s);
+void lockprof_json(strbuf_t *sb);
+
+#ifdef LOCKPROF
+#define LOCKPROF_SITE(fn, obj) do {                                   \
+	static lpsite_t site_ = { __FILE__, __LINE__, #obj };        \
+	fn(&site_, obj);                                             \
+    } while (0)
+#define MUTEX_LOCK(m)   LOCKPROF_SITE(lockprof_mutex_lock, m)
+#define MUTEX_UNLOCK(m) lockprof_mutex_unlock(m)
+#define SEM_LOCK(s)     LOCKPROF_SITE(lockprof_sem_lock, s)
+#define SEM_UNLOCK(s)   lockprof_sem_unlock(s)
+#define SEM_WAIT(s)     LOCKPROF_SITE(lockprof_sem_wait, s)
+#else
+#define MUTEX_LOCK(m)   pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#define SEM_LOCK(s)     P(s)
+#define SEM_UNLOCK(s)   V(s)
+#define SEM_WAIT(s)     P(s)
+#endif
+
+#endif /* __LOCKPROF_H__ */
@@ -0,0 +1,50 @@
+/*
+ * mime.c - Registry of media types by file name extension
+ *
+ * Only a name's final extension counts: "a.html.bak" is not HTML, and
+ * "archive.tar.gz" is gzip. Names without one, and dot files such as
+ * ".profile", have no type.
+ */
+#include <ctype.h>
+#include <string.h>
+#include "mime.h"
+
+const char *mime_classnames[MIME_NCLASSES] = MIME_CLASSNAMES;
+
+/*
+ * mime_lookup - Return the registry entry for the extension of name
+ *     (a file name, path or URL), or NULL if it has none or it isn't
+ *     registered
+ */
+const mime_ent_t *mime_lookup(const char *name)
+{
+    char ext[MIME_MAXEXT + 1];
+    const char *p, *end = name + strcspn(name, "?#");
+    const mime_ent_t *ent;
+    size_t n, i;
+    int d;
+
+    for (p = end; p > name && p[-1] != '.' && p[-1] != '/'; p--)
+	;
+    if (p - name < 2 || p[-1] != '.' || p[-2] == '/')
+	return NULL;                 /* No extension, or a dot file */
+    if ((n = end - p) == 0 || n > MIME_MAXEXT)
+	return NULL;
+    for (i = 0; i < n; i++)
+	ext[i] = tolower((unsigned char)p[i]);
+    ext[n] = '\0';
+
+    d = mime_disp[mime_hash(0, ext) % mime_nslots];
+    ent = &mime_slots[d < 0 ? -d - 1 : mime_hash(d, ext) % mime_nslots];
+    return strcmp(ent->ext, ext) ? NULL : ent;
+}
+
+/*
+ * mime_type - Return the media type of name, or NULL if it is unknown
+ */
+const char *mime_type(const char *name)
+{
+    const mime_ent_t *ent = mime_lookup(name);
+
+    return ent ? ent->type : NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * mime.h - Registry of media types by file name extension
+ *
+ * The table itself is generated: mimegen reads mime.types and writes
+ * mimetab.c, a minimal perfect hash of its extensions, so a lookup is
+ * two hashes of the extension and one string compare, whatever the
+ * size of the table.
+ */
+#ifndef __MIME_H__
+#define __MIME_H__
+
+#define MIME_MAXEXT 16               /* Longest extension looked up */
+
+/* Classes of media types, by top-level type. MIME_OTHER must be last */
+enum { MIME_TEXT, MIME_IMAGE, MIME_AUDIO, MIME_VIDEO, MIME_FONT,
+       MIME_APPLICATION, MIME_OTHER, MIME_NCLASSES };
+#define MIME_CLASSNAMES { "text", "image", "audio", "video", "font", \
+			  "application", "other" }
+
+/* One extension of the registry */
+typedef struct {
+    const char *ext;                 /* Lower case, without the dot */
+    const char *type;                /* Its media type */
+    int class;                       /* MIME_* */
+} mime_ent_t;
+
+/* The generated table (mimetab.c) */
+extern const int mime_nslots;
+extern const mime_ent_t mime_slots[];  /* One entry per slot */
+extern const int mime_disp[];        /* Per bucket: seed, or -slot-1 */
+
+extern const char *mime_classnames[MIME_NCLASSES];
+
+const mime_ent_t *mime_lookup(const char *name);
+const char *mime_type(const char *name);
+
+/*
+ * mime_hash - Hash extension s under seed. Shared by mimegen, which
+ *     searches for seeds that make it perfect, and by lookups.
+ */
+static inline unsigned int mime_hash(unsigned int seed, const char *s)
+{
+    unsigned int h = 2166136261u ^ (seed * 0x9e3779b9u);
+
+    while (*s) {
+	h ^= (unsigned char)*s++;
+	h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+#endif /* __MIME_H__ */
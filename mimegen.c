@@ -0,0 +1,182 @@
+/*
+ * mimegen - Generate the MIME registry's perfect hash table
+ *
+ * usage: mimegen < mime.types > mimetab.c
+ *
+ * Builds a minimal perfect hash of the extensions in mime.types by
+ * hash and displace: the n extensions are split into n buckets by
+ * mime_hash(0, ext), and each bucket, largest first, gets the first
+ * seed d that sends all of its extensions, by mime_hash(d, ext), to
+ * distinct free slots of an n-slot table. Buckets of one extension
+ * just take a free slot, recorded as -slot-1. A lookup then hashes its
+ * extension twice and compares one string.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "mime.h"
+
+#define MAXLINE  1024
+#define MAXSEED  1000000             /* Give up on a bucket past this */
+
+typedef struct {
+    char *ext, *type;
+    int class;
+    int bucket;
+} mkey_t;
+
+static mkey_t *keys;
+static int nkeys, keycap;
+
+static void die(const char *msg, const char *arg)
+{
+    fprintf(stderr, "mimegen: %s%s\n", msg, arg ? arg : "");
+    exit(1);
+}
+
+/* class_of - The MIME_* class of media type type */
+static int class_of(const char *type)
+{
+    static const char *names[MIME_NCLASSES] = MIME_CLASSNAMES;
+    size_t n = strcspn(type, "/");
+    int c;
+
+    for (c = 0; c < MIME_OTHER; c++)
+	if (strlen(names[c]) == n && !strncmp(type, names[c], n))
+	    return c;
+    return MIME_OTHER;
+}
+
+/* read_types - Read "type ext ext ..." lines from fp into keys */
+static void read_types(FILE *fp)
+{
+    char line[MAXLINE], *type, *ext, *p;
+    int i;
+
+    while (fgets(line, MAXLINE, fp)) {
+	if ((p = strchr(line, '#')) != NULL)
+	    *p = '\0';
+	if (!(type = strtok(line, " \t\r\n")))
+	    continue;
+	if (!strchr(type, '/'))
+	    die("not a media type: ", type);
+	while ((ext = strtok(NULL, " \t\r\n")) != NULL) {
+	    for (p = ext; *p; p++)
+		*p = tolower((unsigned char)*p);
+	    if (strlen(ext) > MIME_MAXEXT)
+		die("extension too long: ", ext);
+	    for (i = 0; i < nkeys; i++)
+		if (!strcmp(keys[i].ext, ext))
+		    die("duplicate extension: ", ext);
+	    if (nkeys == keycap) {
+		keycap = keycap ? 2 * keycap : 256;
+		keys = realloc(keys, keycap * sizeof(mkey_t));
+	    }
+	    keys[nkeys].ext = strdup(ext);
+	    keys[nkeys].type = strdup(type);
+	    keys[nkeys].class = class_of(type);
+	    nkeys++;
+	}
+    }
+    if (nkeys == 0)
+	die("no extensions", NULL);
+}
+
+/* C string literal for s; the registry holds no quotes or backslashes */
+static void print_str(const char *s)
+{
+    printf("\"%s\"", s);
+}
+
+int main(void)
+{
+    int *disp, *slot, *bsize, *order, *taken, *tried;
+    int b, i, j, k, m, n, d, nb, ok, free_slot;
+
+    read_types(stdin);
+    n = nkeys;
+    nb = n;
+    disp = calloc(nb, sizeof(int));
+    bsize = calloc(nb, sizeof(int));
+    order = malloc(nb * sizeof(int));
+    slot = malloc(n * sizeof(int));
+    taken = calloc(n, sizeof(int));
+    tried = malloc(n * sizeof(int));
+
+    for (i = 0; i < n; i++) {
+	keys[i].bucket = mime_hash(0, keys[i].ext) % nb;
+	bsize[keys[i].bucket]++;
+    }
+
+    /* Buckets, largest first */
+    for (b = 0; b < nb; b++)
+	order[b] = b;
+    for (i = 1; i < nb; i++)
+	for (j = i; j > 0 && bsize[order[j]] > bsize[order[j-1]]; j--) {
+	    k = order[j];
+	    order[j] = order[j-1];
+	    order[j-1] = k;
+	}
+
+    /* Find a seed for every bucket of two or more */
+    for (i = 0; i < nb && bsize[order[i]] > 1; i++) {
+	b = order[i];
+	for (d = 1; d < MAXSEED; d++) {
+	    /* Every key must land on a free slot no other key of b has */
+	    ok = 1;
+	    for (j = k = 0; j < n && ok; j++) {
+		if (keys[j].bucket != b)
+		    continue;
+		tried[k] = mime_hash(d, keys[j].ext) % n;
+		ok = !taken[tried[k]];
+		for (m = 0; ok && m < k; m++)
+		    ok = tried[m] != tried[k];
+		k++;
+	    }
+	    if (!ok)
+		continue;
+	    for (j = k = 0; j < n; j++)
+		if (keys[j].bucket == b) {
+		    slot[j] = tried[k++];
+		    taken[slot[j]] = 1;
+		}
+	    disp[b] = d;
+	    break;
+	}
+	if (d == MAXSEED)
+	    die("no perfect hash found", NULL);
+    }
+
+    /* Buckets of one take the free slots */
+    for (free_slot = 0; i < nb && bsize[order[i]] == 1; i++) {
+	b = order[i];
+	while (taken[free_slot])
+	    free_slot++;
+	for (j = 0; keys[j].bucket != b; j++)
+	    ;
+	slot[j] = free_slot;
+	taken[free_slot] = 1;
+	disp[b] = -free_slot - 1;
+    }
+
+    printf("/*\n * mimetab.c - Generated from mime.types by mimegen. "
+	   "Do not edit.\n */\n#include \"mime.h\"\n\n");
+    printf("const int mime_nslots = %d;\n\n", n);
+    printf("const int mime_disp[%d] = {", nb);
+    for (b = 0; b < nb; b++)
+	printf("%s%d", b == 0 ? "\n    " : b % 12 ? ", " : ",\n    ",
+	       disp[b]);
+    printf("\n};\n\nconst mime_ent_t mime_slots[%d] = {\n", n);
+    for (k = 0; k < n; k++) {
+	for (j = 0; slot[j] != k; j++)
+	    ;
+	printf("    { ");
+	print_str(keys[j].ext);
+	printf(", ");
+	print_str(keys[j].type);
+	printf(", %d },\n", keys[j].class);
+    }
+    printf("};\n");
+    return 0;
+}
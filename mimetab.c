@@ -0,0 +1,184 @@
+/*
+ * mimetab.c - Generated from mime.types by mimegen. Do not edit.
+ */
+#include "mime.h"
+
+const int mime_nslots = 158;
+
+const int mime_disp[158] = {
+    4, 4, 0, 0, 0, 1, 0, 0, -3, 0, 0, -10,
+    1, -11, -13, -19, -20, -22, 1, -24, 0, 2, -26, 0,
+    -27, 0, -29, 0, -30, -34, -36, -38, -39, 2, 0, 1,
+    0, -42, 0, 3, 0, 0, -43, 0, 0, -45, 0, 2,
+    0, -46, 1, -52, 1, 3, 0, -54, -63, -65, 1, -66,
+    -67, 1, -68, -69, 0, 0, 0, 0, 3, 0, 0, -71,
+    0, 5, -72, 1, 0, 1, 1, 1, 1, -73, 0, -77,
+    -79, 0, 0, 0, -81, 0, 0, -83, 2, -85, -89, -93,
+    6, 4, 1, 1, 3, -94, -95, 0, 0, -98, -102, -104,
+    -108, -109, -113, 0, -116, 0, -119, -124, -125, -126, 4, -127,
+    5, 0, -128, 0, 0, -132, -135, 0, 0, 0, -139, 0,
+    3, -140, -141, 2, -143, 1, 0, -144, 2, 2, -147, -151,
+    0, 0, 1, -152, 7, 0, 0, 0, -156, 0, 6, -158,
+    0, 2
+};
+
+const mime_ent_t mime_slots[158] = {
+    { "7z", "application/x-7z-compressed", 5 },
+    { "htm", "text/html", 0 },
+    { "aac", "audio/aac", 2 },
+    { "md", "text/plain", 0 },
+    { "opus", "audio/ogg", 2 },
+    { "heif", "image/heif", 1 },
+    { "msm", "application/octet-stream", 5 },
+    { "hpp", "text/plain", 0 },
+    { "apng", "image/apng", 1 },
+    { "ico", "image/x-icon", 1 },
+    { "tcl", "application/x-tcl", 5 },
+    { "otf", "font/otf", 4 },
+    { "mp4", "video/mp4", 3 },
+    { "odp", "application/vnd.oasis.opendocument.presentation", 5 },
+    { "sit", "application/x-stuffit", 5 },
+    { "jar", "application/java-archive", 5 },
+    { "xz", "application/x-xz", 5 },
+    { "jardiff", "application/x-java-archive-diff", 5 },
+    { "odg", "application/vnd.oasis.opendocument.graphics", 5 },
+    { "ttf", "font/ttf", 4 },
+    { "swf", "application/x-shockwave-flash", 5 },
+    { "exe", "application/octet-stream", 5 },
+    { "apk", "application/vnd.android.package-archive", 5 },
+    { "mng", "video/x-mng", 3 },
+    { "c", "text/plain", 0 },
+    { "asx", "video/x-ms-asf", 3 },
+    { "cco", "application/x-cocoa", 5 },
+    { "rar", "application/x-rar-compressed", 5 },
+    { "jpeg", "image/jpeg", 1 },
+    { "ra", "audio/x-realaudio", 2 },
+    { "py", "text/plain", 0 },
+    { "jng", "image/x-jng", 1 },
+    { "sea", "application/x-sea", 5 },
+    { "shtml", "text/html", 0 },
+    { "jnlp", "application/x-java-jnlp-file", 5 },
+    { "bash", "application/x-sh", 5 },
+    { "jxl", "image/jxl", 1 },
+    { "wml", "text/vnd.wap.wml", 0 },
+    { "ogv", "video/ogg", 3 },
+    { "oga", "audio/ogg", 2 },
+    { "mpg", "video/mpeg", 3 },
+    { "ai", "application/postscript", 5 },
+    { "so", "application/octet-stream", 5 },
+    { "mml", "text/mathml", 0 },
+    { "ini", "text/plain", 0 },
+    { "woff", "font/woff", 4 },
+    { "der", "application/x-x509-ca-cert", 5 },
+    { "gif", "image/gif", 1 },
+    { "jpg", "image/jpeg", 1 },
+    { "weba", "audio/webm", 2 },
+    { "bin", "application/octet-stream", 5 },
+    { "doc", "application/msword", 5 },
+    { "bmp", "image/bmp", 1 },
+    { "flv", "video/x-flv", 3 },
+    { "flac", "audio/flac", 2 },
+    { "m4v", "video/mp4", 3 },
+    { "ttc", "font/collection", 4 },
+    { "tk", "application/x-tcl", 5 },
+    { "3gpp", "video/3gpp", 3 },
+    { "kmz", "application/vnd.google-earth.kmz", 5 },
+    { "txt", "text/plain", 0 },
+    { "svg", "image/svg+xml", 1 },
+    { "atom", "application/atom+xml", 5 },
+    { "pdf", "application/pdf", 5 },
+    { "mpeg", "video/mpeg", 3 },
+    { "odt", "application/vnd.oasis.opendocument.text", 5 },
+    { "log", "text/plain", 0 },
+    { "mov", "video/quicktime", 3 },
+    { "js", "text/javascript", 0 },
+    { "jsonld", "application/ld+json", 5 },
+    { "wbmp", "image/vnd.wap.wbmp", 1 },
+    { "css", "text/css", 0 },
+    { "prc", "application/x-pilot", 5 },
+    { "midi", "audio/midi", 2 },
+    { "run", "application/x-makeself", 5 },
+    { "text", "text/plain", 0 },
+    { "mp3", "audio/mpeg", 2 },
+    { "woff2", "font/woff2", 4 },
+    { "avif", "image/avif", 1 },
+    { "kar", "audio/midi", 2 },
+    { "gz", "application/gzip", 5 },
+    { "svgz", "image/svg+xml", 1 },
+    { "war", "application/java-archive", 5 },
+    { "htc", "text/x-component", 0 },
+    { "ppt", "application/vnd.ms-powerpoint", 5 },
+    { "pm", "application/x-perl", 5 },
+    { "iso", "application/octet-stream", 5 },
+    { "php", "application/x-httpd-php", 5 },
+    { "mjs", "text/javascript", 0 },
+    { "img", "application/octet-stream", 5 },
+    { "mid", "audio/midi", 2 },
+    { "vcf", "text/vcard", 0 },
+    { "tiff", "image/tiff", 1 },
+    { "h", "text/plain", 0 },
+    { "msp", "application/octet-stream", 5 },
+    { "json", "application/json", 5 },
+    { "conf", "text/plain", 0 },
+    { "dll", "application/octet-stream", 5 },
+    { "webm", "video/webm", 3 },
+    { "eps", "application/postscript", 5 },
+    { "xpi", "application/x-xpinstall", 5 },
+    { "tgz", "application/gzip", 5 },
+    { "jsonp", "application/javascript", 5 },
+    { "crt", "application/x-x509-ca-cert", 5 },
+    { "o", "application/octet-stream", 5 },
+    { "hqx", "application/mac-binhex40", 5 },
+    { "zip", "application/zip", 5 },
+    { "xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet", 5 },
+    { "wmv", "video/x-ms-wmv", 3 },
+    { "asf", "video/x-ms-asf", 3 },
+    { "jad", "text/vnd.sun.j2me.app-descriptor", 0 },
+    { "ogg", "audio/ogg", 2 },
+    { "bz2", "application/x-bzip2", 5 },
+    { "docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document", 5 },
+    { "xml", "text/xml", 0 },
+    { "xhtml", "application/xhtml+xml", 5 },
+    { "epub", "application/epub+zip", 5 },
+    { "m4a", "audio/x-m4a", 2 },
+    { "wav", "audio/wav", 2 },
+    { "markdown", "text/markdown", 0 },
+    { "rtf", "application/rtf", 5 },
+    { "png", "image/png", 1 },
+    { "m3u8", "application/vnd.apple.mpegurl", 5 },
+    { "cpp", "text/plain", 0 },
+    { "pem", "application/x-x509-ca-cert", 5 },
+    { "jpe", "image/jpeg", 1 },
+    { "a", "application/octet-stream", 5 },
+    { "rss", "application/rss+xml", 5 },
+    { "ps", "application/postscript", 5 },
+    { "ics", "text/calendar", 0 },
+    { "xls", "application/vnd.ms-excel", 5 },
+    { "kml", "application/vnd.google-earth.kml+xml", 5 },
+    { "mkv", "video/x-matroska", 3 },
+    { "ods", "application/vnd.oasis.opendocument.spreadsheet", 5 },
+    { "heic", "image/heic", 1 },
+    { "cc", "text/plain", 0 },
+    { "sql", "application/sql", 5 },
+    { "tsv", "text/tab-separated-values", 0 },
+    { "webmanifest", "application/manifest+json", 5 },
+    { "html", "text/html", 0 },
+    { "csv", "text/csv", 0 },
+    { "tar", "application/x-tar", 5 },
+    { "tif", "image/tiff", 1 },
+    { "dmg", "application/octet-stream", 5 },
+    { "rpm", "application/x-redhat-package-manager", 5 },
+    { "zst", "application/zstd", 5 },
+    { "avi", "video/x-msvideo", 3 },
+    { "msi", "application/octet-stream", 5 },
+    { "ts", "video/mp2t", 3 },
+    { "ear", "application/java-archive", 5 },
+    { "sh", "text/plain", 0 },
+    { "wasm", "application/wasm", 5 },
+    { "3gp", "video/3gpp", 3 },
+    { "pdb", "application/x-pilot", 5 },
+    { "pl", "text/plain", 0 },
+    { "webp", "image/webp", 1 },
+    { "pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation", 5 },
+    { "deb", "application/octet-stream", 5 },
+};
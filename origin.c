@@ -0,0 +1,169 @@
+/*
+ * origin.c - Per-origin connection limits with fair request queueing
+ *
+ * Each origin (host:port) may have at most max requests talking to it
+ * at once. A request beyond that is queued on its origin's FIFO rather
+ * than holding a worker. When a slot frees up and the origin has
+ * waiters, the origin joins a ready ring, and the releasing worker
+ * takes its next request from the ring in round-robin order. A slow or
+ * popular origin thus ties up at most max workers and descriptors, and
+ * never starves the others.
+ */
+#include "csapp.h"
+#include "origin.h"
+#include "lockprof.h"
+
+static origin_t **origin_bucket(origintab_t *tp, const char *key)
+{
+    unsigned int h = 2166136261u;
+
+    while (*key)
+	h = (h ^ (unsigned char)*key++) * 16777619u;
+    return &tp->buckets[h % ORIGIN_NBUCKETS];
+}
+
+/* origin_unref - Forget o once nobody holds or waits for a slot */
+static void origin_unref(origintab_t *tp, origin_t *o)
+{
+    origin_t **pp;
+
+    if (o->active > 0 || o->head || o->ready)
+	return;
+    for (pp = origin_bucket(tp, o->key); *pp != o; pp = &(*pp)->hnext)
+	;
+    *pp = o->hnext;
+    Free(o->key);
+    Free(o);
+}
+
+/* ready_push - Put o at the tail of the ready ring */
+static void ready_push(origintab_t *tp, origin_t *o)
+{
+    o->ready = 1;
+    o->rnext = NULL;
+    if (tp->ready_tail)
+	tp->ready_tail->rnext = o;
+    else
+	tp->ready_head = o;
+    tp->ready_tail = o;
+}
+
+/* ready_pop - Take the origin at the head of the ready ring */
+static origin_t *ready_pop(origintab_t *tp)
+{
+    origin_t *o = tp->ready_head;
+
+    if (o) {
+	if (!(tp->ready_head = o->rnext))
+	    tp->ready_tail = NULL;
+	o->ready = 0;
+    }
+    return o;
+}
+
+/*
+ * origintab_init - Allow max concurrent requests per origin (no limit
+ *     if max is 0)
+ */
+void origintab_init(origintab_t *tp, int max)
+{
+    pthread_mutex_init(&tp->mutex, NULL);
+    memset(tp->buckets, 0, sizeof(tp->buckets));
+    tp->ready_head = tp->ready_tail = NULL;
+    tp->max = max;
+    tp->nwaiting = 0;
+}
+
+/*
+ * origin_acquire - Ask for a slot on host:port for item. Returns 1 if
+ *     the slot was granted, or 0 if item was queued instead, in which
+ *     case a later origin_release() hands it out. Either way *op is set
+ *     to the origin, which stays valid while item holds or awaits a slot.
+ */
+int origin_acquire(origintab_t *tp, const char *host, const char *port,
+		   void *item, origin_t **op)
+{
+    char key[MAXLINE];
+    origin_t **bp, *o;
+    owait_t *w;
+    int granted;
+
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+    MUTEX_LOCK(&tp->mutex);
+    bp = origin_bucket(tp, key);
+    for (o = *bp; o && strcmp(o->key, key); o = o->hnext)
+	;
+    if (!o) {
+	o = Calloc(1, sizeof(origin_t));
+	o->key = strdup(key);
+	o->hnext = *bp;
+	*bp = o;
+    }
+
+    /* Never overtake requests that are already waiting */
+    if ((granted = !o->head && (tp->max <= 0 || o->active < tp->max)))
+	o->active++;
+    else {
+	w = Malloc(sizeof(owait_t));
+	w->item = item;
+	w->next = NULL;
+	if (o->tail)
+	    o->tail->next = w;
+	else
+	    o->head = w;
+	o->tail = w;
+	tp->nwaiting++;
+    }
+    MUTEX_UNLOCK(&tp->mutex);
+    *op = o;
+    return granted;
+}
+
+/*
+ * origin_release - Give back the slot held on *op. Returns the next
+ *     waiting item, taken round-robin from the origins that have a
+ *     free slot, with its slot already granted and *op set to its
+ *     origin; or NULL if nothing is waiting.
+ */
+void *origin_release(origintab_t *tp, origin_t **op)
+{
+    origin_t *o = *op;
+    owait_t *w;
+    void *item = NULL;
+
+    MUTEX_LOCK(&tp->mutex);
+    o->active--;
+    if (o->head && !o->ready)
+	ready_push(tp, o);
+    else
+	origin_unref(tp, o);
+
+    if ((o = ready_pop(tp)) != NULL) {
+	w = o->head;
+	if (!(o->head = w->next))
+	    o->tail = NULL;
+	tp->nwaiting--;
+	o->active++;
+	item = w->item;
+	Free(w);
+	/* Still room for another waiter? Then back of the line */
+	if (o->head && (tp->max <= 0 || o->active < tp->max))
+	    ready_push(tp, o);
+	*op = o;
+    }
+    MUTEX_UNLOCK(&tp->mutex);
+    return item;
+}
+
+/*
+ * origin_nwaiting - Number of requests parked on all origins
+ */
+int origin_nwaiting(origintab_t *tp)
+{
+    int n;
+
+    MUTEX_LOCK(&tp->mutex);
+    n = tp->nwaiting;
+    MUTEX_UNLOCK(&tp->mutex);
+    return n;
+}
@@ -0,0 +1,41 @@
+/*
+ * origin.h - Per-origin connection limits with fair request queueing
+ */
+#ifndef __ORIGIN_H__
+#define __ORIGIN_H__
+
+#include "csapp.h"
+
+#define ORIGIN_NBUCKETS 256
+
+/* A request waiting for a connection slot */
+typedef struct owait {
+    void *item;
+    struct owait *next;
+} owait_t;
+
+/* An origin server, identified by host and port */
+typedef struct origin {
+    char *key;                       /* "host:port" */
+    int active;                      /* Slots held by requests */
+    owait_t *head, *tail;            /* Waiting requests, oldest first */
+    int ready;                       /* Set while on the ready ring */
+    struct origin *hnext;            /* Hash chain */
+    struct origin *rnext;            /* Ready ring */
+} origin_t;
+
+typedef struct {
+    pthread_mutex_t mutex;           /* Protects everything below */
+    origin_t *buckets[ORIGIN_NBUCKETS];
+    origin_t *ready_head, *ready_tail; /* Origins with a slot for a waiter */
+    int max;                         /* Slots per origin, 0 for no limit */
+    int nwaiting;                    /* Requests waiting, all origins */
+} origintab_t;
+
+void origintab_init(origintab_t *tp, int max);
+int origin_acquire(origintab_t *tp, const char *host, const char *port,
+		   void *item, origin_t **op);
+void *origin_release(origintab_t *tp, origin_t **op);
+int origin_nwaiting(origintab_t *tp);
+
+#endif /* __ORIGIN_H__ */
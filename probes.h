@@ -0,0 +1,45 @@
+/*
+ * probes.h - USDT (SystemTap/DTrace-style) static tracepoints
+ *
+ * PROBEn(name, args...) marks a point that bpftrace, perf or SystemTap
+ * can attach to at run time, e.g.
+ *
+ *     bpftrace -e 'usdt:./proxy:proxy:response__done { @[arg1] = count(); }'
+ *
+ * A probe that nobody is tracing is a single nop in the instruction
+ * stream plus a note in the binary. The arguments are computed anyway,
+ * so pass only values that are already at hand. Where <sys/sdt.h> is
+ * missing, or with -DNO_PROBES, every probe compiles to nothing.
+ *
+ * The provider name is PROBE_PROVIDER, "proxy" unless the including
+ * file defines it first.
+ */
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+#ifndef PROBE_PROVIDER
+#define PROBE_PROVIDER proxy
+#endif
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+#include <sys/sdt.h>
+#define PROBE0(name)             DTRACE_PROBE(PROBE_PROVIDER, name)
+#define PROBE1(name, a)          DTRACE_PROBE1(PROBE_PROVIDER, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(PROBE_PROVIDER, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(PROBE_PROVIDER, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(PROBE_PROVIDER, name, a, b, c, d)
+#else
+#define PROBE0(name)             do { } while (0)
+#define PROBE1(name, a)          do { } while (0)
+#define PROBE2(name, a, b)       do { } while (0)
+#define PROBE3(name, a, b, c)    do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* __PROBES_H__ */
@@ -1,14 +1,964 @@
-#include <stdio.h>
+/*
+ * proxy.c - A concurrent, caching HTTP/1.0 web proxy
+ *
+ * The main thread accepts client connections and hands them to a pool
+ * of NTHREADS workers through a bounded buffer. A worker reads one GET
+ * or HEAD request, answers it from the cache if it can, and otherwise
+ * forwards it to the origin server and relays the response, caching a
+ * GET's when it is small enough. A hit serves a HEAD the cached
+ * headers alone, and a GET with a single byte Range just that slice of
+ * the cached body, as a 206, so resumed downloads of cached objects
+ * never go back to the origin.
+ *
+ * Every socket operation on this path uses the error-returning rio_*
+ * functions (and send() with MSG_NOSIGNAL), never the csapp wrappers
+ * that exit: a reset client or an unreachable origin ends only the
+ * transaction it belongs to.
+ *
+ * Each connection carries a timer on a shared timing wheel, re-armed as
+ * it moves through its phases (reading headers, connecting, awaiting
+ * the response, relaying). When a deadline passes, the timer shuts
+ * down the socket the worker is blocked on, so the blocked call returns
+ * and the worker releases the connection. While headers arrive, the
+ * deadline tracks a minimum transfer rate to fend off slowloris-style
+ * clients.
+ *
+ * Admission control sheds load before it consumes a worker: a client
+ * address with too many open connections is turned away at accept
+ * time, and connections that sat in the queue too long while it is
+ * standing get a fast 503 instead of being served late.
+ *
+ * Requests that miss the cache also need one of a limited number of
+ * slots on their origin server. A request that finds them all taken is
+ * parked on the origin's queue and its worker moves on; whichever
+ * worker frees a slot next picks up a parked request.
+ *
+ * A GET for STATS_PATH (or STATS_URI) is answered by the proxy itself
+ * with a JSON report: per-phase latency histograms, event counters,
+ * cache effectiveness, queue depths and open descriptors.
+ *
+ * With -l, every completed request is also recorded in a binary access
+ * log (see alog.c) without blocking the worker that served it.
+ * With -t, each request is also captured as the client sent it, with
+ * its timing, status and size, in a trace (see trace.c) that
+ * tools/replay can re-issue against any proxy.
+ *
+ * USDT probes (see probes.h) mark each step of a request's life. All
+ * take the conn_t pointer as their first argument to tie them together.
+ */
+#include "csapp.h"
+#include "sbuf.h"
+#include "cache.h"
+#include "http.h"
+#include "twheel.h"
+#include "admit.h"
+#include "origin.h"
+#include "stats.h"
+#include "alog.h"
+#include "trace.h"
+#include "probes.h"
+#include "lockprof.h"
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+#define NTHREADS      16              /* Worker threads */
+#define SBUFSIZE      64              /* Connections waiting for a worker */
+#define CACHE_NSHARDS 8               /* Independently locked cache shards */
+#define HDR_BUFSIZE   1024            /* Rio buffer for request headers */
+#define RELAY_BUFSIZE RIO_MAXBUFSIZE  /* Rio buffer for origin responses */
+#define RANGE_MAXLEN  64              /* Longest Range served from cache */
+
+/* Deadlines, in milliseconds */
+#define HDR_GRACE        2000   /* Header time before HDR_MINRATE applies */
+#define HDR_MINRATE      256    /* Header bytes/s a client must sustain */
+#define HDR_TIMEOUT      10000  /* Accept to end of request headers */
+#define CONNECT_TIMEOUT  5000   /* Resolve and connect to the origin */
+#define QUEUE_TIMEOUT    10000  /* Parked waiting for an origin slot */
+#define RESPONSE_TIMEOUT 15000  /* Request sent to first response byte */
+#define IDLE_TIMEOUT     15000  /* Max stall while relaying a response */
+
+/* Admission control */
+#define MAX_CLIENT_CONNS 128    /* Default open connections per client */
+#define CODEL_TARGET     50     /* Acceptable standing queue delay, ms */
+#define CODEL_INTERVAL   500    /* Queue delay measurement interval, ms */
+#define MAX_ORIGIN_CONNS 8      /* Default concurrent requests per origin */
+
+/* The proxy's own metrics, in origin form or as an absolute URI */
+#define STATS_PATH "/__stats"
+#define STATS_URI  "http://proxy" STATS_PATH
+
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
+static const char *conn_hdr = "Connection: close\r\n";
+static const char *proxy_conn_hdr = "Proxy-Connection: close\r\n";
+
+/* Connection phases, which decide what an expired deadline shuts down */
+enum { PH_HEADER, PH_QUEUE, PH_CONNECT, PH_RESPONSE, PH_RELAY };
+
+/* A parsed request bound for the origin, in one heap block */
+typedef struct {
+    char *uri, *host, *port;          /* Point into data */
+    char *request;                    /* Rewritten request for the origin */
+    size_t reqlen;
+    char data[];
+} req_t;
+
+/* A client connection handed from the accept loop to a worker */
+typedef struct {
+    int fd;                           /* Connected client socket */
+    struct sockaddr_storage addr;     /* Client address */
+    socklen_t addrlen;
+    int serverfd;                     /* Origin socket, or -1 */
+    int phase;                        /* PH_* */
+    int expired;                      /* Set once a deadline has passed */
+    unsigned long accepted;           /* Accept time, in now_ms() */
+    unsigned long t_accept;           /* Accept time, in stats_now() */
+    unsigned long t_parsed;           /* Request parsed, or 0 */
+    const char *uri;                  /* Request URI, once parsed */
+    int head;                         /* HEAD: send the headers only */
+    char range[RANGE_MAXLEN];         /* Range header to honor, or "" */
+    int status;                       /* Response status sent */
+    int hit;                          /* Served from the cache */
+    size_t bytes;                     /* Response bytes sent */
+    unsigned long ttfb;               /* Origin first byte, in us */
+    char *rawreq;                     /* Request as received, if tracing */
+    size_t rawlen;
+    int rawtrunc;                     /* rawreq is missing some of it */
+    size_t hdrbytes;                  /* Request bytes read so far */
+    unsigned long deadline;           /* Current deadline, in now_ms() */
+    twtimer_t timer;                  /* Deadline of the current phase */
+    req_t *req;                       /* Request awaiting the origin */
+} conn_t;
+
+static sbuf_t sbuf;     /* Accepted connections */
+static cache_t cache;   /* Shared web object cache */
+static twheel_t wheel;  /* Connection deadlines */
+static iplimit_t iplimit; /* Open connections per client address */
+static codel_t codel;   /* Work queue delay controller */
+static origintab_t origins; /* Slots and parked requests per origin */
+
+void *thread(void *vargp);
+void doit(conn_t *conn);
+int read_request(conn_t *conn, rio_t *rp, char *uri, char *host, char *port,
+		 char *request);
+int read_requesthdrs(conn_t *conn, rio_t *rp, char *hdrs, size_t maxlen,
+		     char *host, char *port);
+void serve_cached(conn_t *conn, cache_obj_t *obj);
+void serve_origin(conn_t *conn, origin_t *o);
+void forward(conn_t *conn, char *uri, char *host, char *port, char *request,
+	     size_t reqlen);
+int connect_server(conn_t *conn, char *host, char *port);
+void clienterror(int fd, char *cause, char *errnum,
+		 char *shortmsg, char *longmsg);
+void conn_error(conn_t *conn, char *cause, char *errnum,
+		char *shortmsg, char *longmsg);
+void reject(int fd, char *errnum, char *shortmsg);
+void serve_stats(int fd);
+
+/* now_ms - Milliseconds on the monotonic clock */
+static unsigned long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * conn_expire - timer callback: shut down the socket the worker may be
+ *     blocked on. Runs on the wheel thread with the wheel locked.
+ */
+static void conn_expire(twtimer_t *t)
+{
+    conn_t *conn = t->arg;
+
+    conn->expired = 1;
+    if (conn->phase == PH_HEADER)
+	shutdown(conn->fd, SHUT_RD);    /* Leave room to send a 408 */
+    else if (conn->phase == PH_RELAY)
+	shutdown(conn->fd, SHUT_RDWR);
+    if (conn->serverfd >= 0)
+	shutdown(conn->serverfd, SHUT_RDWR);
+}
+
+/* conn_arm - Enter phase with a deadline ms milliseconds from now */
+static void conn_arm(conn_t *conn, int phase, unsigned int ms)
+{
+    twheel_del(&wheel, &conn->timer);
+    conn->phase = phase;
+    conn->deadline = now_ms() + ms;
+    if (!conn->expired)
+	twheel_add(&wheel, &conn->timer, ms);
+}
 
-int main()
+/* conn_disarm - Cancel the deadline; nonzero if it had already passed */
+static int conn_disarm(conn_t *conn)
 {
-    printf("%s", user_agent_hdr);
+    twheel_del(&wheel, &conn->timer);
+    return conn->expired;
+}
+
+/*
+ * conn_setserver - Record the origin socket (or -1) where the timer can
+ *     see it, keeping the current deadline. The timer is stopped while
+ *     the field changes, so it never acts on a stale descriptor.
+ *     Returns -1 if the deadline has already passed.
+ */
+static int conn_setserver(conn_t *conn, int fd)
+{
+    long left;
+
+    twheel_del(&wheel, &conn->timer);
+    conn->serverfd = fd;
+    if (conn->expired)
+	return -1;
+    left = (long)(conn->deadline - now_ms());
+    twheel_add(&wheel, &conn->timer, left > 0 ? left : 0);
     return 0;
 }
+
+/* conn_closeserver - Close the origin socket, if there is one */
+static void conn_closeserver(conn_t *conn)
+{
+    int fd = conn->serverfd;
+
+    if (fd < 0)
+	return;
+    conn_setserver(conn, -1);
+    close(fd);
+}
+
+/*
+ * conn_progress - Count n more request bytes from the client and move
+ *     the header deadline: after HDR_GRACE ms the client must have kept
+ *     up HDR_MINRATE bytes/s, and may never take over HDR_TIMEOUT ms
+ */
+static void conn_progress(conn_t *conn, size_t n)
+{
+    unsigned long deadline, now = now_ms();
+
+    conn->hdrbytes += n;
+    deadline = conn->accepted + HDR_GRACE + conn->hdrbytes * 1000 / HDR_MINRATE;
+    if (deadline > conn->accepted + HDR_TIMEOUT)
+	deadline = conn->accepted + HDR_TIMEOUT;
+    conn_arm(conn, PH_HEADER, deadline > now ? deadline - now : 0);
+}
+
+/* conn_capture - Keep a copy of request text read from the client */
+static void conn_capture(conn_t *conn, const char *buf, size_t n)
+{
+    if (!conn->rawreq)
+	return;
+    if (n > TRACE_MAXREQ - conn->rawlen) {
+	n = TRACE_MAXREQ - conn->rawlen;
+	conn->rawtrunc = 1;
+    }
+    memcpy(conn->rawreq + conn->rawlen, buf, n);
+    conn->rawlen += n;
+}
+
+/* conn_trace - Append a done request to the trace */
+static void conn_trace(conn_t *conn, unsigned long total)
+{
+    trace_rec_t rec;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    rec.time_us = tv.tv_sec * 1000000UL + tv.tv_usec - total;
+    rec.bytes = conn->bytes;
+    rec.total_us = total;
+    rec.ttfb_us = conn->ttfb;
+    rec.status = conn->status;
+    rec.flags = (conn->hit ? TRACE_HIT : 0) | (conn->rawtrunc ? TRACE_TRUNC : 0);
+    rec.reqlen = conn->rawlen;
+    trace_write(&rec, conn->rawreq);
+}
+
+/*
+ * conn_log - Account for a request that is done: record its latency,
+ *     bytes and (when logging) an access log entry
+ */
+static void conn_log(conn_t *conn)
+{
+    alog_rec_t rec;
+    unsigned long total = stats_now() - conn->t_accept;
+    struct timeval tv;
+
+    stats_record(ST_TOTAL, total);
+    stats_add(SC_BYTES_OUT, conn->bytes);
+    PROBE4(response__done, conn, conn->status, conn->bytes, total);
+    if (conn->rawreq)
+	conn_trace(conn, total);
+    if (!alog_enabled())
+	return;
+
+    memset(&rec, 0, sizeof(rec));
+    gettimeofday(&tv, NULL);
+    rec.time_us = tv.tv_sec * 1000000UL + tv.tv_usec;
+    rec.total_us = total;
+    rec.ttfb_us = conn->ttfb;
+    rec.bytes = conn->bytes;
+    rec.status = conn->status;
+    rec.flags = conn->hit ? ALOG_HIT : 0;
+    alog_setclient(&rec, &conn->addr);
+    alog_seturl(&rec, conn->uri);
+    if (alog_write(&rec) < 0)
+	stats_add(SC_LOGDROPS, 1);
+}
+
+/* conn_free - Close the client connection and release its resources */
+static void conn_free(conn_t *conn)
+{
+    if (conn->t_parsed)
+	conn_log(conn);
+    twheel_del(&wheel, &conn->timer);
+    close(conn->fd);
+    iplimit_release(&iplimit, &conn->addr);
+    if (conn->req)
+	Free(conn->req);
+    if (conn->rawreq)
+	Free(conn->rawreq);
+    Free(conn);
+}
+
+/* req_new - Copy a parsed request into a single heap block */
+static req_t *req_new(char *uri, char *host, char *port, char *request,
+		      size_t reqlen)
+{
+    size_t ulen = strlen(uri) + 1, hlen = strlen(host) + 1;
+    size_t plen = strlen(port) + 1;
+    req_t *req = Malloc(sizeof(req_t) + ulen + hlen + plen + reqlen);
+
+    req->uri = memcpy(req->data, uri, ulen);
+    req->host = memcpy(req->uri + ulen, host, hlen);
+    req->port = memcpy(req->host + hlen, port, plen);
+    req->request = memcpy(req->port + plen, request, reqlen);
+    req->reqlen = reqlen;
+    return req;
+}
+
+int main(int argc, char **argv)
+{
+    int listenfd, i, c, maxconns = MAX_CLIENT_CONNS;
+    int maxorigin = MAX_ORIGIN_CONNS;
+    char *logfile = NULL, *policy = NULL, *tracefile = NULL;
+    size_t logmax = 0;
+    pthread_t tid;
+    conn_t *conn;
+
+    /* Check command line args */
+    while ((c = getopt(argc, argv, "c:o:l:r:p:t:")) != -1) {
+	switch (c) {
+	case 'c':
+	    maxconns = atoi(optarg);
+	    break;
+	case 'o':
+	    maxorigin = atoi(optarg);
+	    break;
+	case 'l':
+	    logfile = optarg;
+	    break;
+	case 'r':
+	    logmax = strtoul(optarg, NULL, 0);
+	    break;
+	case 'p':
+	    policy = optarg;
+	    break;
+	case 't':
+	    tracefile = optarg;
+	    break;
+	default:
+	    optind = argc;  /* Force the usage message */
+	    break;
+	}
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr, "usage: %s [-c maxconns-per-client] "
+		"[-o maxconns-per-origin] [-l logfile [-r rotate-bytes]]\n"
+		"       [-p lru|fifo|clock] [-t tracefile] <port>\n", argv[0]);
+	exit(1);
+    }
+    if (logfile && alog_open(logfile, logmax) < 0)
+	unix_error("Can't open access log");
+    if (tracefile && trace_open(tracefile) < 0)
+	unix_error("Can't open trace");
+
+    listenfd = Open_listenfd(argv[optind]);
+    sbuf_init(&sbuf, SBUFSIZE);
+    twheel_init(&wheel);
+    iplimit_init(&iplimit, maxconns);
+    codel_init(&codel, CODEL_TARGET, CODEL_INTERVAL);
+    origintab_init(&origins, maxorigin);
+    cache_init(&cache, MAX_CACHE_SIZE, MAX_OBJECT_SIZE, CACHE_NSHARDS);
+    if (policy && cache_setpolicy(&cache, policy) < 0)
+	app_error("Unknown cache policy");
+    for (i = 0; i < NTHREADS; i++)
+	Pthread_create(&tid, NULL, thread, NULL);
+
+    while (1) {
+	conn = Malloc(sizeof(conn_t));
+	conn->addrlen = sizeof(conn->addr);
+	if ((conn->fd = accept(listenfd, (SA *)&conn->addr, &conn->addrlen)) < 0) {
+	    /* Out of descriptors: back off instead of spinning */
+	    if (errno == EMFILE || errno == ENFILE)
+		usleep(10000);
+	    Free(conn);
+	    continue;
+	}
+	if (iplimit_acquire(&iplimit, &conn->addr) < 0) {
+	    reject(conn->fd, "429", "Too Many Requests");
+	    stats_add(SC_REJECTED, 1);
+	    close(conn->fd);
+	    Free(conn);
+	    continue;
+	}
+	conn->serverfd = -1;
+	conn->expired = 0;
+	conn->accepted = now_ms();
+	conn->t_accept = stats_now();
+	conn->t_parsed = 0;
+	conn->uri = NULL;
+	conn->head = 0;
+	conn->range[0] = '\0';
+	conn->status = 0;
+	conn->hit = 0;
+	conn->bytes = 0;
+	conn->ttfb = 0;
+	conn->rawreq = NULL;
+	conn->rawlen = 0;
+	conn->rawtrunc = 0;
+	conn->hdrbytes = 0;
+	conn->req = NULL;
+	twtimer_init(&conn->timer, conn_expire, conn);
+	conn_arm(conn, PH_HEADER, HDR_GRACE);
+	PROBE2(accept, conn, conn->fd);
+	sbuf_insert(&sbuf, conn);
+    }
+}
+
+/*
+ * thread - worker thread routine: serve connections until killed
+ */
+void *thread(void *vargp)
+{
+    conn_t *conn;
+    unsigned long now;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+	conn = sbuf_remove(&sbuf);
+	now = now_ms();
+	if (codel_admit(&codel, now - conn->accepted, now))
+	    doit(conn);
+	else {
+	    reject(conn->fd, "503", "Service Unavailable");
+	    conn_free(conn);
+	}
+    }
+    return NULL;
+}
+
+/*
+ * doit - handle one HTTP request/response transaction. Takes ownership
+ *     of conn, which is freed when done or parked on its origin's queue.
+ */
+void doit(conn_t *conn)
+{
+    char uri[MAXLINE], host[MAXLINE], port[MAXLINE], request[MAXBUF];
+    int reqlen;
+    cache_obj_t *obj;
+    origin_t *o;
+    rio_t rio;
+
+    /* Read and rewrite the request; GET and HEAD have no body to keep */
+    if (trace_enabled())
+	conn->rawreq = Malloc(TRACE_MAXREQ);
+    rio_readinitbsz(&rio, conn->fd, HDR_BUFSIZE);
+    reqlen = read_request(conn, &rio, uri, host, port, request);
+    rio_readfreeb(&rio);
+    if (reqlen < 0) {
+	conn_free(conn);
+	return;
+    }
+    if (!*host) {   /* Asked for our own statistics */
+	conn_arm(conn, PH_RELAY, IDLE_TIMEOUT);
+	serve_stats(conn->fd);
+	conn_free(conn);
+	return;
+    }
+    conn->t_parsed = stats_now();
+    conn->uri = uri;
+    stats_record(ST_PARSE, conn->t_parsed - conn->t_accept);
+    stats_add(SC_REQUESTS, 1);
+    PROBE2(request__parsed, conn, uri);
+
+    /* Serve from the cache if possible */
+    if ((obj = cache_lookup(&cache, uri)) != NULL) {
+	PROBE3(cache__hit, conn, uri, obj->size);
+	conn_arm(conn, PH_RELAY, IDLE_TIMEOUT);
+	serve_cached(conn, obj);
+	cache_release(&cache, obj);
+	conn_free(conn);
+	return;
+    }
+
+    /* Go to the origin now, or wait in line for it. Once parked, conn
+       belongs to whichever worker frees a slot, so arm the timer first */
+    PROBE2(cache__miss, conn, uri);
+    conn->req = req_new(uri, host, port, request, reqlen);
+    conn->uri = conn->req->uri;
+    conn_arm(conn, PH_QUEUE, QUEUE_TIMEOUT);
+    if (origin_acquire(&origins, host, port, conn, &o))
+	serve_origin(conn, o);
+}
+
+/*
+ * range_headers - write into buf the headers of a 206 response carrying
+ *     bytes [first, last] of a size-byte body, made from the hdrlen
+ *     bytes of cached response headers at hdrs. Returns their length,
+ *     or 0 if they don't fit in MAXBUF.
+ */
+static size_t range_headers(const char *hdrs, size_t hdrlen, char *buf,
+			    size_t first, size_t last, size_t size)
+{
+    char line[MAXLINE], name[MAXLINE], value[MAXLINE];
+    const char *p, *eol, *end = hdrs + hdrlen;
+    size_t len, n;
+
+    len = sprintf(buf, "HTTP/1.0 206 Partial Content\r\n");
+    p = (const char *)memchr(hdrs, '\n', hdrlen) + 1;  /* Past the status */
+    for (; p < end; p = eol + 1) {
+	eol = memchr(p, '\n', end - p);
+	if ((n = eol - p + 1) >= MAXLINE)
+	    return 0;
+	memcpy(line, p, n);
+	line[n] = '\0';
+	if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+	    break;
+	if (parse_header(line, name, value) == 0 &&
+	    (!strcasecmp(name, "Content-Length") ||
+	     !strcasecmp(name, "Content-Range")))
+	    continue;
+	if (len + n >= MAXBUF)
+	    return 0;
+	memcpy(buf + len, line, n);
+	len += n;
+    }
+    n = snprintf(buf + len, MAXBUF - len, "Content-Length: %zu\r\n"
+		 "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+		 last - first + 1, first, last, size);
+    return n < MAXBUF - len ? len + n : 0;
+}
+
+/*
+ * serve_cached - answer conn from the cached response obj: all of it,
+ *     its headers alone for a HEAD, or one byte range of its body as a
+ *     206 (or a 416 if the range lies past its end)
+ */
+void serve_cached(conn_t *conn, cache_obj_t *obj)
+{
+    char buf[MAXBUF];
+    size_t body, first, last, n = 0, len;
+    int rc = 0;
+
+    conn->hit = 1;
+    conn->status = 200;   /* Only 200 responses are cached */
+    if ((body = parse_hdrend(obj->data, obj->size)) == 0)
+	body = obj->size;
+    len = conn->head ? body : obj->size;
+    if (!conn->head && *conn->range)
+	rc = parse_range(conn->range, obj->size - body, &first, &last);
+
+    if (rc > 0 && (n = range_headers(obj->data, body, buf, first, last,
+				     obj->size - body)) > 0) {
+	conn->status = 206;
+	if (rio_sendn(conn->fd, buf, n) > 0 &&
+	    rio_sendn(conn->fd, obj->data + body + first, last - first + 1) > 0)
+	    conn->bytes = n + last - first + 1;
+    }
+    else if (rc < 0) {
+	conn->status = 416;
+	n = snprintf(buf, MAXBUF, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+		     "Content-Range: bytes */%zu\r\nContent-Length: 0\r\n\r\n",
+		     obj->size - body);
+	if (rio_sendn(conn->fd, buf, n) > 0)
+	    conn->bytes = n;
+    }
+    else if (rio_sendn(conn->fd, obj->data, len) > 0)
+	conn->bytes = len;
+}
+
+/*
+ * serve_origin - forward conn's request over the slot it holds on o,
+ *     then pass each freed slot on to the next parked request
+ */
+void serve_origin(conn_t *conn, origin_t *o)
+{
+    req_t *req;
+
+    while (conn) {
+	req = conn->req;
+	if (conn_disarm(conn))  /* Waited too long in the origin's queue */
+	    conn_error(conn, req->host, "504", "Gateway Timeout",
+		       "Proxy timed out waiting for a connection to");
+	else
+	    forward(conn, req->uri, req->host, req->port, req->request,
+		    req->reqlen);
+	conn_free(conn);
+	conn = origin_release(&origins, &o);
+    }
+}
+
+/*
+ * read_request - read the request line and headers from the client and
+ *     build the request to send to the origin. Returns its length, or
+ *     -1 if the client has already been answered or has gone away. A
+ *     request for the stats page leaves host empty.
+ */
+int read_request(conn_t *conn, rio_t *rp, char *uri, char *host, char *port,
+		 char *request)
+{
+    char buf[MAXLINE], method[MAXLINE], version[MAXLINE], path[MAXLINE];
+    int fd = conn->fd, len, hdrlen;
+    ssize_t n;
+
+    if ((n = rio_readlineb(rp, buf, MAXLINE)) <= 0) {
+	if (conn_disarm(conn))
+	    clienterror(fd, "request", "408", "Request Timeout",
+			"Proxy timed out waiting for the");
+	return -1;
+    }
+    conn_progress(conn, n);
+    conn_capture(conn, buf, n);
+    if (parse_requestline(buf, method, uri, version) < 0) {
+	clienterror(fd, "request line", "400", "Bad Request",
+		    "Proxy couldn't parse the");
+	return -1;
+    }
+    if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
+	clienterror(fd, method, "501", "Not Implemented",
+		    "Proxy does not implement this method");
+	return -1;
+    }
+    conn->head = !strcasecmp(method, "HEAD");
+    if (!strcmp(uri, STATS_PATH) || !strcasecmp(uri, STATS_URI)) {
+	*host = *port = '\0';
+	strcpy(path, STATS_PATH);
+    }
+    else if (parse_uri(uri, host, port, path) < 0) {
+	clienterror(fd, uri, "400", "Bad Request",
+		    "Proxy couldn't parse the URI");
+	return -1;
+    }
+
+    len = snprintf(request, MAXBUF, "%s %s HTTP/1.0\r\n",
+		   conn->head ? "HEAD" : "GET", path);
+    if (len >= MAXBUF ||
+	(hdrlen = read_requesthdrs(conn, rp, request + len, MAXBUF - len,
+				 host, port)) < 0) {
+	if (conn_disarm(conn))
+	    clienterror(fd, "request headers", "408", "Request Timeout",
+			"Proxy timed out waiting for the");
+	else
+	    clienterror(fd, uri, "400", "Bad Request",
+			"Proxy couldn't read the request headers for");
+	return -1;
+    }
+    return len + hdrlen;
+}
+
+/*
+ * read_requesthdrs - read the client's request headers and write the
+ *     ones to forward into hdrs, replacing Host (if absent), User-Agent,
+ *     Connection and Proxy-Connection with our own and dropping
+ *     Accept-Encoding, so that the origin sends the identity coding
+ *     every client can take and the cache can keep. Note in conn
+ *     a Range the cache could serve. Returns the length of hdrs, or -1
+ *     on a read error, an overlong line or overflow.
+ */
+int read_requesthdrs(conn_t *conn, rio_t *rp, char *hdrs, size_t maxlen,
+		     char *host, char *port)
+{
+    char buf[MAXLINE], name[MAXLINE], value[MAXLINE], hosthdr[MAXLINE];
+    size_t len = 0, n;
+    ssize_t rc;
+    int v6 = strchr(host, ':') != NULL, ifrange = 0;
+
+    if (!strcmp(port, HTTP_DEFPORT))
+	snprintf(hosthdr, MAXLINE, "Host: %s%s%s\r\n", v6 ? "[" : "", host,
+		 v6 ? "]" : "");
+    else
+	snprintf(hosthdr, MAXLINE, "Host: %s%s%s:%s\r\n", v6 ? "[" : "", host,
+		 v6 ? "]" : "", port);
+
+    while ((rc = rio_readlineb(rp, buf, MAXLINE)) > 0) {
+	if (buf[rc-1] != '\n')             /* Line didn't fit */
+	    return -1;
+	conn_progress(conn, rc);
+	conn_capture(conn, buf, rc);
+	if (!strcmp(buf, "\r\n") || !strcmp(buf, "\n"))
+	    break;
+	if (parse_header(buf, name, value) < 0)
+	    continue;
+	if (!strcasecmp(name, "Host")) {
+	    strcpy(hosthdr, buf);
+	    continue;
+	}
+	if (!strcasecmp(name, "Range") && strlen(value) < RANGE_MAXLEN)
+	    strcpy(conn->range, value);
+	if (!strcasecmp(name, "If-Range"))
+	    ifrange = 1;
+	if (!strcasecmp(name, "User-Agent") || !strcasecmp(name, "Connection") ||
+	    !strcasecmp(name, "Proxy-Connection") ||
+	    !strcasecmp(name, "Accept-Encoding"))
+	    continue;
+	if (len + rc >= maxlen)
+	    return -1;
+	memcpy(hdrs + len, buf, rc);
+	len += rc;
+    }
+    if (rc <= 0)
+	return -1;
+    if (ifrange)   /* Conditional on a validator we don't check: ignore */
+	conn->range[0] = '\0';
+
+    n = snprintf(hdrs + len, maxlen - len, "%s%s%s%s\r\n", hosthdr,
+		 user_agent_hdr, conn_hdr, proxy_conn_hdr);
+    if (n >= maxlen - len)
+	return -1;
+    return len + n;
+}
+
+/*
+ * forward - send request to the origin and relay its response to the
+ *     client, caching complete 200 responses to GETs of at most
+ *     MAX_OBJECT_SIZE. The cache is keyed by URI alone, so a response
+ *     that Varies with request headers is not cached: it could be the
+ *     wrong one for the next client. Varying with Accept-Encoding alone
+ *     is the exception, since no request we send has one.
+ */
+void forward(conn_t *conn, char *uri, char *host, char *port, char *request,
+	     size_t reqlen)
+{
+    int fd = conn->fd, status = -1;
+    size_t objsize = 0;
+    unsigned long sent;
+    ssize_t n;
+    char buf[MAXBUF], *obj;
+    rio_t rio;
+
+    conn_arm(conn, PH_CONNECT, CONNECT_TIMEOUT);
+    if (connect_server(conn, host, port) < 0) {
+	if (conn_disarm(conn))
+	    conn_error(conn, host, "504", "Gateway Timeout",
+		       "Proxy timed out connecting to");
+	else
+	    conn_error(conn, host, "502", "Bad Gateway",
+		       "Proxy couldn't connect to");
+	return;
+    }
+    conn_arm(conn, PH_RESPONSE, RESPONSE_TIMEOUT);
+    if (rio_sendn(conn->serverfd, request, reqlen) < 0) {
+	conn_closeserver(conn);
+	conn_error(conn, host, "502", "Bad Gateway",
+		   "Proxy couldn't send the request to");
+	return;
+    }
+    sent = stats_now();
+
+    obj = Malloc(MAX_OBJECT_SIZE);
+    rio_readinitbsz(&rio, conn->serverfd, RELAY_BUFSIZE);
+    while ((n = rio_readb(&rio, buf, MAXBUF)) > 0) {
+	if (objsize == 0) {
+	    conn->ttfb = stats_now() - sent;
+	    stats_record(ST_TTFB, conn->ttfb);
+	    conn->status = status = parse_status(buf, n);
+	    PROBE3(first__byte, conn, status, conn->ttfb);
+	}
+	if (objsize + n <= MAX_OBJECT_SIZE)
+	    memcpy(obj + objsize, buf, n);
+	objsize += n;
+	conn_arm(conn, PH_RELAY, IDLE_TIMEOUT);
+	if (rio_sendn(fd, buf, n) < 0)   /* Client went away */
+	    break;
+	conn->bytes += n;
+    }
+    rio_readfreeb(&rio);
+    conn_closeserver(conn);
+
+    /* Cache only responses that arrived whole and in time */
+    if (conn->expired) {
+	if (objsize == 0)
+	    conn_error(conn, host, "504", "Gateway Timeout",
+		       "Proxy timed out waiting for a response from");
+    }
+    else if (n == 0 && status == 200 && !conn->head &&
+	     objsize <= MAX_OBJECT_SIZE &&
+	     vary_only(obj, objsize, "Accept-Encoding"))
+	cache_insert(&cache, uri, obj, objsize);
+    Free(obj);
+}
+
+/*
+ * connect_server - open_clientfd(), except that each socket is recorded
+ *     in conn before connect() so that the connect deadline can abort
+ *     it. Returns 0 with conn->serverfd connected, -1 on failure.
+ */
+int connect_server(conn_t *conn, char *host, char *port)
+{
+    struct addrinfo hints, *listp, *p;
+    int fd, rc = -1;
+    unsigned long start = stats_now();
+
+    /* Get a list of potential server addresses */
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
+    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
+    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
+    if (getaddrinfo(host, port, &hints, &listp) != 0)
+	return -1;
+    stats_record(ST_DNS, stats_now() - start);
+    start = stats_now();
+
+    /* Walk the list for one that we can successfully connect to */
+    for (p = listp; p && !conn->expired; p = p->ai_next) {
+	if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+	    continue;
+	if (conn_setserver(conn, fd) == 0 &&
+	    connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+	    stats_record(ST_CONNECT, stats_now() - start);
+	    PROBE3(origin__connect, conn, host, port);
+	    rc = 0;
+	    break;
+	}
+	conn_closeserver(conn);
+    }
+    freeaddrinfo(listp);
+    return rc;
+}
+
+/*
+ * clienterror - returns an error message to the client
+ */
+void clienterror(int fd, char *cause, char *errnum,
+		 char *shortmsg, char *longmsg)
+{
+    char buf[MAXLINE], body[MAXBUF];
+
+    if (!strcmp(errnum, "408") || !strcmp(errnum, "504"))
+	stats_add(SC_TIMEOUTS, 1);
+    else
+	stats_add(SC_ERRORS, 1);
+
+    /* Build the HTTP response body */
+    snprintf(body, MAXBUF,
+	     "<html><title>Proxy Error</title>"
+	     "<body bgcolor=""ffffff"">\r\n"
+	     "%s: %s\r\n"
+	     "<p>%s %s\r\n"
+	     "<hr><em>The Proxy</em>\r\n",
+	     errnum, shortmsg, longmsg, cause);
+
+    /* Print the HTTP response */
+    snprintf(buf, MAXLINE, "HTTP/1.0 %s %s\r\n"
+	     "Content-type: text/html\r\n"
+	     "Content-length: %d\r\n\r\n",
+	     errnum, shortmsg, (int)strlen(body));
+    if (rio_sendn(fd, buf, strlen(buf)) < 0)
+	return;
+    rio_sendn(fd, body, strlen(body));
+}
+
+/*
+ * conn_error - clienterror() for a parsed request, noting the status
+ */
+void conn_error(conn_t *conn, char *cause, char *errnum,
+		char *shortmsg, char *longmsg)
+{
+    conn->status = atoi(errnum);
+    clienterror(conn->fd, cause, errnum, shortmsg, longmsg);
+}
+
+/*
+ * reject - turn away a connection we will not serve with a short error
+ *     response, without blocking. The caller closes fd.
+ */
+void reject(int fd, char *errnum, char *shortmsg)
+{
+    char buf[MAXLINE];
+
+    snprintf(buf, MAXLINE, "HTTP/1.0 %s %s\r\n"
+	     "Retry-After: 1\r\n"
+	     "Content-length: 0\r\n\r\n", errnum, shortmsg);
+    send(fd, buf, strlen(buf), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    /* Drain what the client already sent so close() doesn't reset */
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, buf, MAXLINE, MSG_DONTWAIT) > 0)
+	;
+}
+
+/* count_fds - Number of descriptors the process has open */
+static int count_fds(void)
+{
+    DIR *dp;
+    struct dirent *de;
+    int n = 0;
+
+    if (!(dp = opendir("/proc/self/fd")))
+	return -1;
+    while ((de = readdir(dp)) != NULL)
+	if (de->d_name[0] != '.')
+	    n++;
+    closedir(dp);
+    return n - 1;   /* Not counting dp's own descriptor */
+}
+
+/*
+ * serve_stats - send the proxy's metrics to the client as JSON
+ */
+void serve_stats(int fd)
+{
+    strbuf_t sb;
+    cache_stats_t cs;
+    unsigned long shed;
+    int overloaded, c;
+    char buf[MAXLINE];
+
+    strbuf_init(&sb);
+    strbuf_printf(&sb, "{\n");
+    stats_json(&sb);
+
+    cache_stats(&cache, &cs);
+    strbuf_printf(&sb, ",\n\"cache\": {\"hits\": %lu, \"misses\": %lu, "
+		  "\"hit_bytes\": %lu, \"inserts\": %lu, \"evictions\": %lu, "
+		  "\"evicted_bytes\": %lu, \"objects\": %d, \"bytes\": %zu,\n"
+		  "  \"bytes_by_type\": {",
+		  cs.hits, cs.misses, cs.hitbytes, cs.inserts, cs.evictions,
+		  cs.evictbytes, cs.nobjs, cs.size);
+    for (c = 0; c < MIME_NCLASSES; c++)
+	strbuf_printf(&sb, "%s\"%s\": %zu", c ? ", " : "",
+		      mime_classnames[c], cs.classbytes[c]);
+    strbuf_printf(&sb, "}}");
+
+    MUTEX_LOCK(&codel.mutex);
+    shed = codel.shed;
+    overloaded = codel.overloaded;
+    MUTEX_UNLOCK(&codel.mutex);
+    strbuf_printf(&sb, ",\n\"queue\": {\"accepted\": %d, "
+		  "\"origin_waiting\": %d, \"shed\": %lu, \"overloaded\": %d}",
+		  sbuf_count(&sbuf), origin_nwaiting(&origins), shed, overloaded);
+    strbuf_printf(&sb, ",\n\"open_fds\": %d,\n", count_fds());
+    lockprof_json(&sb);
+    strbuf_printf(&sb, "\n}\n");
+
+    snprintf(buf, MAXLINE, "HTTP/1.0 200 OK\r\n"
+	     "Content-type: application/json\r\n"
+	     "Cache-Control: no-store\r\n"
+	     "Content-length: %zu\r\n\r\n", sb.len);
+    if (rio_sendn(fd, buf, strlen(buf)) >= 0)
+	rio_sendn(fd, sb.buf, sb.len);
+    strbuf_free(&sb);
+}
@@ -0,0 +1,241 @@
+/*
+ * stats.c - Lock-free per-thread counters and latency histograms
+ *
+ * Each thread records into its own stats_t, allocated on first use and
+ * kept on a global registry. The owner is the only writer, so a
+ * recording is a relaxed load and store with no lock and no shared
+ * cache line. Readers merge all registered blocks on demand, which
+ * yields a consistent enough picture for monitoring.
+ */
+#include "csapp.h"
+#include "stats.h"
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stats_t *registry;                 /* Every thread's block */
+static __thread stats_t *mystats;         /* This thread's block */
+
+static const char *phase_names[ST_NPHASES] = {
+    "accept_to_parsed", "dns", "connect", "origin_ttfb", "total"
+};
+static const char *counter_names[SC_NCOUNTERS] = {
+    "requests", "rejected", "timeouts", "errors", "bytes_out",
+    "log_drops"
+};
+
+/* bump - Add n to a counter that only the calling thread writes */
+static inline void bump(unsigned long *p, unsigned long n)
+{
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n,
+		     __ATOMIC_RELAXED);
+}
+
+static inline unsigned long peek(const unsigned long *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/* self - Return this thread's block, registering it on first use */
+static stats_t *self(void)
+{
+    if (!mystats) {
+	mystats = Calloc(1, sizeof(stats_t));
+	pthread_mutex_lock(&registry_mutex);
+	mystats->next = registry;
+	registry = mystats;
+	pthread_mutex_unlock(&registry_mutex);
+    }
+    return mystats;
+}
+
+/* hist_index - Bucket holding value v */
+static int hist_index(unsigned long v)
+{
+    int msb, shift;
+
+    if (v < 2 * HIST_SUB)
+	return v;
+    if (v >= 1UL << HIST_MAXBITS)
+	return HIST_NBUCKETS - 1;
+    msb = 63 - __builtin_clzl(v);
+    shift = msb - HIST_SUBBITS;
+    return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+/* hist_value - Smallest value in bucket idx */
+static unsigned long hist_value(int idx)
+{
+    int shift;
+
+    if (idx < 2 * HIST_SUB)
+	return idx;
+    shift = idx / HIST_SUB - 1;
+    return (unsigned long)(idx % HIST_SUB + HIST_SUB) << shift;
+}
+
+/*
+ * hist_record - Add value v to a histogram that only the calling thread
+ *     writes
+ */
+void hist_record(hist_t *hp, unsigned long v)
+{
+    bump(&hp->counts[hist_index(v)], 1);
+    bump(&hp->total, 1);
+    bump(&hp->sum, v);
+    if (v > peek(&hp->max))
+	__atomic_store_n(&hp->max, v, __ATOMIC_RELAXED);
+}
+
+/*
+ * hist_percentile - Value below which a fraction q of the recorded
+ *     values fall, as the upper edge of its bucket
+ */
+unsigned long hist_percentile(const hist_t *hp, double q)
+{
+    unsigned long rank, seen = 0;
+    int i;
+
+    if (hp->total == 0)
+	return 0;
+    rank = (unsigned long)(q * hp->total);
+    if (rank >= hp->total)
+	rank = hp->total - 1;
+    for (i = 0; i < HIST_NBUCKETS; i++) {
+	seen += hp->counts[i];
+	if (seen > rank)
+	    break;
+    }
+    if (i >= HIST_NBUCKETS - 1)
+	return hp->max;
+    return hist_value(i + 1) - 1 < hp->max ? hist_value(i + 1) - 1 : hp->max;
+}
+
+/*
+ * stats_now - Microseconds on the monotonic clock
+ */
+unsigned long stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+ * stats_record - Record a latency of usec microseconds for phase
+ */
+void stats_record(int phase, unsigned long usec)
+{
+    hist_record(&self()->phases[phase], usec);
+}
+
+/*
+ * stats_add - Add n to counter
+ */
+void stats_add(int counter, unsigned long n)
+{
+    bump(&self()->counters[counter], n);
+}
+
+/*
+ * stats_merge - Sum every thread's statistics into *sp
+ */
+void stats_merge(stats_t *sp)
+{
+    stats_t *tp;
+    int p, i;
+
+    memset(sp, 0, sizeof(stats_t));
+    pthread_mutex_lock(&registry_mutex);
+    for (tp = registry; tp; tp = tp->next) {
+	for (p = 0; p < ST_NPHASES; p++) {
+	    for (i = 0; i < HIST_NBUCKETS; i++)
+		sp->phases[p].counts[i] += peek(&tp->phases[p].counts[i]);
+	    sp->phases[p].total += peek(&tp->phases[p].total);
+	    sp->phases[p].sum += peek(&tp->phases[p].sum);
+	    if (peek(&tp->phases[p].max) > sp->phases[p].max)
+		sp->phases[p].max = peek(&tp->phases[p].max);
+	}
+	for (i = 0; i < SC_NCOUNTERS; i++)
+	    sp->counters[i] += peek(&tp->counters[i]);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    /* Recordings race with the merge; make totals match the buckets */
+    for (p = 0; p < ST_NPHASES; p++)
+	for (i = 0, sp->phases[p].total = 0; i < HIST_NBUCKETS; i++)
+	    sp->phases[p].total += sp->phases[p].counts[i];
+}
+
+/*
+ * stats_json - Append the merged counters and phase histograms to sb
+ *     as the members of a JSON object
+ */
+void stats_json(strbuf_t *sb)
+{
+    stats_t *sp = Malloc(sizeof(stats_t));
+    hist_t *hp;
+    int p, i, first;
+
+    stats_merge(sp);
+    strbuf_printf(sb, "\"counters\": {");
+    for (i = 0; i < SC_NCOUNTERS; i++)
+	strbuf_printf(sb, "%s\"%s\": %lu", i ? ", " : "", counter_names[i],
+		      sp->counters[i]);
+    strbuf_printf(sb, "},\n\"latency_us\": {");
+    for (p = 0; p < ST_NPHASES; p++) {
+	hp = &sp->phases[p];
+	strbuf_printf(sb, "%s\n  \"%s\": {\"count\": %lu, \"mean\": %lu, "
+		      "\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, "
+		      "\"p999\": %lu, \"max\": %lu, \"buckets\": [",
+		      p ? "," : "", phase_names[p], hp->total,
+		      hp->total ? hp->sum / hp->total : 0,
+		      hist_percentile(hp, 0.5), hist_percentile(hp, 0.9),
+		      hist_percentile(hp, 0.99), hist_percentile(hp, 0.999),
+		      hp->max);
+	for (i = 0, first = 1; i < HIST_NBUCKETS; i++) {
+	    if (!hp->counts[i])
+		continue;
+	    strbuf_printf(sb, "%s[%lu, %lu]", first ? "" : ", ",
+			  hist_value(i), hp->counts[i]);
+	    first = 0;
+	}
+	strbuf_printf(sb, "]}");
+    }
+    strbuf_printf(sb, "\n}");
+    Free(sp);
+}
+
+/*********************************
+ * Growable strings
+ *********************************/
+
+void strbuf_init(strbuf_t *sb)
+{
+    sb->size = MAXBUF;
+    sb->buf = Malloc(sb->size);
+    sb->buf[0] = '\0';
+    sb->len = 0;
+}
+
+/* strbuf_printf - Append printf-formatted text to sb */
+void strbuf_printf(strbuf_t *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    while (1) {
+	va_start(ap, fmt);
+	n = vsnprintf(sb->buf + sb->len, sb->size - sb->len, fmt, ap);
+	va_end(ap);
+	if (n < sb->size - sb->len)
+	    break;
+	sb->size = 2 * sb->size + n;
+	sb->buf = Realloc(sb->buf, sb->size);
+    }
+    sb->len += n;
+}
+
+void strbuf_free(strbuf_t *sb)
+{
+    Free(sb->buf);
+}
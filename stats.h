@@ -0,0 +1,73 @@
+/*
+ * stats.h - Lock-free per-thread counters and latency histograms
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "csapp.h"
+
+/*
+ * Histograms are HDR-style log-linear: values below 2*HIST_SUB are
+ * exact, larger ones fall in buckets HIST_SUB to an octave, so every
+ * bucket is within 1/HIST_SUB (about 3%) of the values it holds.
+ */
+#define HIST_SUBBITS  5
+#define HIST_SUB      (1 << HIST_SUBBITS)
+#define HIST_MAXBITS  36                   /* Values up to 2^36 us (19 h) */
+#define HIST_NBUCKETS ((HIST_MAXBITS - HIST_SUBBITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long counts[HIST_NBUCKETS];
+    unsigned long total;                   /* Values recorded */
+    unsigned long sum;                     /* Their sum */
+    unsigned long max;                     /* The largest */
+} hist_t;
+
+/* Request phases with a latency histogram, in microseconds */
+enum {
+    ST_PARSE,       /* Accept to request parsed */
+    ST_DNS,         /* Origin name lookup */
+    ST_CONNECT,     /* Origin TCP connect */
+    ST_TTFB,        /* Request sent to first response byte */
+    ST_TOTAL,       /* Accept to response complete */
+    ST_NPHASES
+};
+
+/* Event counters */
+enum {
+    SC_REQUESTS,    /* Requests parsed */
+    SC_REJECTED,    /* Connections over the per-client limit */
+    SC_TIMEOUTS,    /* 408 and 504 responses */
+    SC_ERRORS,      /* Other error responses */
+    SC_BYTES_OUT,   /* Response bytes sent to clients */
+    SC_LOGDROPS,    /* Access log records dropped on a full ring */
+    SC_NCOUNTERS
+};
+
+/* One thread's statistics; only that thread ever writes to it */
+typedef struct stats {
+    hist_t phases[ST_NPHASES];
+    unsigned long counters[SC_NCOUNTERS];
+    struct stats *next;                    /* Registry of all threads */
+} stats_t;
+
+/* Growable string for rendering reports */
+typedef struct {
+    char *buf;
+    size_t len, size;
+} strbuf_t;
+
+unsigned long stats_now(void);
+void stats_record(int phase, unsigned long usec);
+void stats_add(int counter, unsigned long n);
+void stats_merge(stats_t *sp);
+void stats_json(strbuf_t *sb);
+
+void hist_record(hist_t *hp, unsigned long v);
+unsigned long hist_percentile(const hist_t *hp, double q);
+
+void strbuf_init(strbuf_t *sb);
+void strbuf_printf(strbuf_t *sb, const char *fmt, ...);
+void strbuf_free(strbuf_t *sb);
+
+#endif /* __STATS_H__ */
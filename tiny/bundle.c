@@ -0,0 +1,149 @@
+/*
+ * bundle.c - Serve static files from an archive mapped into memory
+ *
+ * The archive (see bundle.h and mkbundle.c) is mapped once, read-only,
+ * and checked from end to end at startup, and the response headers of
+ * every file are built then too. After that a request costs one index
+ * probe and a string compare: no path resolution, stat() or open(),
+ * and the contents go to the client straight from the mapping.
+ */
+#include "csapp.h"
+#include "bundle.h"
+
+static char *map;                    /* The archive, mapped */
+static size_t maplen;
+static const bundle_hdr_t *hdr;
+static const bundle_rec_t *recs;
+static const uint32_t *slots;        /* Its index */
+static bentry_t *entries;            /* One per record, in record order */
+
+/* in_map - Do off and len lie within the archive? */
+static int in_map(uint64_t off, uint64_t len)
+{
+    return off <= maplen && len <= maplen - off;
+}
+
+/* bad - Report a malformed archive and undo bundle_open */
+static int bad(const char *filename, const char *why)
+{
+    fprintf(stderr, "tiny: %s: %s\n", filename, why);
+    Munmap(map, maplen);
+    map = NULL;
+    return -1;
+}
+
+/* find - Index of the record for path, or -1 */
+static int find(const char *path)
+{
+    uint32_t mask = hdr->nslots - 1, i, r;
+
+    for (i = bundle_hash(path) & mask; (r = slots[i]) != 0;
+	 i = (i + 1) & mask)
+	if (!strcmp(map + recs[r - 1].path, path))
+	    return r - 1;
+    return -1;
+}
+
+/*
+ * bundle_open - Map the archive filename and make it the source of all
+ *     static content, with headers formatted by hdrfn. Returns 0, or
+ *     -1 with a message on stderr if it can't be used.
+ */
+int bundle_open(const char *filename, bhdrs_t *hdrfn)
+{
+    struct stat st;
+    bentry_t *be;
+    char buf[MAXBUF], gzname[MAXLINE];
+    uint32_t n, i, used, ngz;
+    int fd, j;
+
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+	fprintf(stderr, "tiny: %s: %s\n", filename, strerror(errno));
+	return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(bundle_hdr_t)) {
+	close(fd);
+	fprintf(stderr, "tiny: %s: not a bundle\n", filename);
+	return -1;
+    }
+
+    /* Fault it all in now rather than on the first requests */
+    maplen = st.st_size;
+    map = Mmap(0, maplen, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    /* Check the layout before trusting an offset in it */
+    hdr = (const bundle_hdr_t *)map;
+    if (memcmp(hdr->magic, BUNDLE_MAGIC, sizeof(hdr->magic)))
+	return bad(filename, "not a bundle");
+    n = hdr->nentries;
+    if (hdr->nslots == 0 || (hdr->nslots & (hdr->nslots - 1)) ||
+	hdr->nslots < 2 * (uint64_t)n ||
+	!in_map(sizeof(bundle_hdr_t), (uint64_t)n * sizeof(bundle_rec_t) +
+		(uint64_t)hdr->nslots * sizeof(uint32_t)))
+	return bad(filename, "bad index");
+    recs = (const bundle_rec_t *)(hdr + 1);
+    slots = (const uint32_t *)(recs + n);
+    for (i = used = 0; i < hdr->nslots; i++) {
+	if (slots[i] > n)
+	    return bad(filename, "bad index");
+	used += slots[i] != 0;
+    }
+    if (used != n)                   /* Leaves empty slots to end probes */
+	return bad(filename, "bad index");
+    for (i = 0; i < n; i++)
+	if (!in_map(recs[i].path, 1) ||
+	    !memchr(map + recs[i].path, '\0', maplen - recs[i].path) ||
+	    !in_map(recs[i].data, recs[i].size))
+	    return bad(filename, "bad entry");
+    for (i = 0; i < n; i++)
+	if (find(map + recs[i].path) != (int)i)
+	    return bad(filename, "index doesn't match entries");
+
+    /* Entries for the mapped files, each paired with its precompressed
+       variant, and with their headers built now */
+    entries = Calloc(n ? n : 1, sizeof(bentry_t));
+    for (i = 0; i < n; i++) {
+	be = &entries[i];
+	be->path = map + recs[i].path;
+	be->data = map + recs[i].data;
+	be->size = recs[i].size;
+	if (snprintf(gzname, MAXLINE, "%s.gz", be->path) < MAXLINE &&
+	    (j = find(gzname)) >= 0)
+	    be->gz = &entries[j];
+    }
+    for (i = 0; i < n; i++) {
+	be = &entries[i];
+	be->hdrlen = hdrfn(buf, be->path, be->size, 0, be->gz != NULL);
+	be->hdrs = Malloc(be->hdrlen);
+	memcpy(be->hdrs, buf, be->hdrlen);
+	if (!be->gz)
+	    continue;
+	be->gzhdrlen = hdrfn(buf, be->gz->path, be->gz->size, 1, 1);
+	be->gzhdrs = Malloc(be->gzhdrlen);
+	memcpy(be->gzhdrs, buf, be->gzhdrlen);
+    }
+    for (i = ngz = 0; i < n; i++)
+	ngz += entries[i].gz != NULL;
+    printf("Serving %u files (%u with gzip variants) from %s\n", n, ngz,
+	   filename);
+    return 0;
+}
+
+/*
+ * bundle_enabled - Is static content served from a bundle?
+ */
+int bundle_enabled(void)
+{
+    return map != NULL;
+}
+
+/*
+ * bundle_lookup - Return the bundled file path ("./dir/file"), or NULL
+ */
+bentry_t *bundle_lookup(const char *path)
+{
+    int i = find(path);
+
+    return i < 0 ? NULL : &entries[i];
+}
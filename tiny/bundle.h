@@ -0,0 +1,71 @@
+/*
+ * bundle.h - Archive of a document root that Tiny serves from memory
+ *
+ * mkbundle packs the regular files under a directory into one file;
+ * "tiny -b" maps it once and serves static requests straight from the
+ * mapping. The layout, in host byte order:
+ *
+ *     bundle_hdr_t                     magic and counts
+ *     bundle_rec_t[nentries]           one per file, sorted by path
+ *     uint32_t[nslots]                 hash index: record + 1, or 0
+ *     paths                            NUL-terminated, "./dir/file"
+ *     file contents                    each 8-byte aligned
+ *
+ * The index is open addressing with linear probing on bundle_hash()
+ * of the path; nslots is a power of 2 at least twice nentries.
+ */
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BUNDLE_MAGIC "TINYBND1"
+
+typedef struct {
+    char magic[8];                   /* BUNDLE_MAGIC, no NUL */
+    uint32_t nentries;
+    uint32_t nslots;
+} bundle_hdr_t;
+
+typedef struct {
+    uint64_t path;                   /* Offset of the path */
+    uint64_t data;                   /* Offset of the contents */
+    uint64_t size;                   /* Bytes of contents */
+} bundle_rec_t;
+
+/* A file of the loaded bundle */
+typedef struct bentry {
+    const char *path;                /* As served: "./dir/file" */
+    const char *data;                /* Contents, in the mapping */
+    off_t size;
+    char *hdrs;                      /* Response headers for a GET */
+    size_t hdrlen;
+    struct bentry *gz;               /* path.gz, if bundled, or NULL */
+    char *gzhdrs;                    /* Headers for sending gz instead */
+    size_t gzhdrlen;
+} bentry_t;
+
+/* Formats into buf the headers of a 200 for a file; see static_headers */
+typedef size_t bhdrs_t(char *buf, const char *path, off_t size, int gz,
+		       int vary);
+
+int bundle_open(const char *filename, bhdrs_t *hdrfn);
+int bundle_enabled(void);
+bentry_t *bundle_lookup(const char *path);
+
+/*
+ * bundle_hash - 32-bit FNV-1a hash of path, for the index
+ */
+static inline uint32_t bundle_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+	h ^= (unsigned char)*s++;
+	h *= 16777619u;
+    }
+    return h;
+}
+
+#endif /* __BUNDLE_H__ */
@@ -1,36 +1,99 @@
 /*
  * adder.c - a minimal CGI program that adds two numbers together
+ *
+ * Run as "adder -w" it is a persistent worker instead (see cgiw.h):
+ * it answers one request after another on descriptor CGIW_FD, and so
+ * does its startup once rather than once per request. Built as
+ * adder.so it is a handler that Tiny loads and calls in place (see
+ * handler.h), with no process at all.
  */
 /* $begin adder */
 #include "csapp.h"
+#include "cgiw.h"
+#include "handler.h"
 
-int main(void) {
-    char *buf, *p;
-    char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
+/* respond - Write the CGI output for query string buf into out */
+static int respond(const char *buf, char *out, size_t size)
+{
+    const char *p;
+    char content[MAXLINE];
     int n1=0, n2=0;
 
     /* Extract the two arguments */
-    if ((buf = getenv("QUERY_STRING")) != NULL) {
-	p = strchr(buf, '&');
-	*p = '\0';
-	strcpy(arg1, buf);
-	strcpy(arg2, p+1);
-	n1 = atoi(arg1);
-	n2 = atoi(arg2);
+    if (buf != NULL) {
+	n1 = atoi(buf);
+	if ((p = strchr(buf, '&')) != NULL)
+	    n2 = atoi(p+1);
     }
 
     /* Make the response body */
-    sprintf(content, "Welcome to add.com: ");
-    sprintf(content, "%sTHE Internet addition portal.\r\n<p>", content);
-    sprintf(content, "%sThe answer is: %d + %d = %d\r\n<p>", 
-	    content, n1, n2, n1 + n2);
-    sprintf(content, "%sThanks for visiting!\r\n", content);
-  
+    snprintf(content, sizeof(content), "Welcome to add.com: "
+	     "THE Internet addition portal.\r\n<p>"
+	     "The answer is: %d + %d = %d\r\n<p>"
+	     "Thanks for visiting!\r\n", n1, n2, n1 + n2);
+
     /* Generate the HTTP response */
-    printf("Connection: close\r\n");
-    printf("Content-length: %d\r\n", (int)strlen(content));
-    printf("Content-type: text/html\r\n\r\n");
-    printf("%s", content);
+    return snprintf(out, size, "Connection: close\r\n"
+		    "Content-length: %d\r\n"
+		    "Content-type: text/html\r\n\r\n%s",
+		    (int)strlen(content), content);
+}
+
+/* tiny_handler - Entry point when loaded by Tiny as adder.so */
+int tiny_handler(const char *query, hwrite_t *hwrite, void *ctx)
+{
+    char out[MAXBUF];
+    int n = respond(query, out, sizeof(out));
+
+    hwrite(ctx, out, n < MAXBUF ? n : MAXBUF - 1);
+    return 0;
+}
+
+/* readall - Read exactly n bytes from fd. Returns 0, or -1 on EOF/error */
+static int readall(int fd, void *buf, size_t n)
+{
+    ssize_t rc;
+
+    while (n > 0) {
+	if ((rc = read(fd, buf, n)) < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return -1;
+	buf = (char *)buf + rc;
+	n -= rc;
+    }
+    return 0;
+}
+
+/* serve - Worker loop: answer framed requests until Tiny hangs up */
+static void serve(void)
+{
+    char query[MAXLINE], out[MAXBUF + sizeof(uint32_t)];
+    uint32_t len = CGIW_HELLO;
+    int n;
+
+    if (write(CGIW_FD, &len, sizeof(len)) != sizeof(len))
+	return;
+    while (readall(CGIW_FD, &len, sizeof(len)) == 0 && len < MAXLINE &&
+	   readall(CGIW_FD, query, len) == 0) {
+	query[len] = '\0';
+	n = respond(query, out + sizeof(len), MAXBUF);
+	len = n < MAXBUF ? n : MAXBUF - 1;
+	memcpy(out, &len, sizeof(len));
+	if (write(CGIW_FD, out, sizeof(len) + len) != sizeof(len) + len)
+	    break;
+    }
+}
+
+int main(int argc, char **argv) {
+    char out[MAXBUF];
+
+    if (argc > 1 && !strcmp(argv[1], CGIW_FLAG)) {
+	serve();
+	exit(0);
+    }
+    respond(getenv("QUERY_STRING"), out, sizeof(out));
+    printf("%s", out);
     fflush(stdout);
 
     exit(0);
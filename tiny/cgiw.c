@@ -0,0 +1,216 @@
+/*
+ * cgiw.c - Pools of persistent CGI worker processes
+ *
+ * Each CGI program gets a pool of nworkers long-running workers (see
+ * cgiw.h for the protocol), started the first time they are needed.
+ * A request checks out an idle worker, blocking while all of them are
+ * busy, so concurrent requests are spread over the pool and no request
+ * pays for a fork() and execve(). A worker that fails is reaped and
+ * restarted on its next use; the request it failed is reported to the
+ * caller, which can still run the program the classic way because
+ * nothing has been sent to the client yet. A program that turns out
+ * not to be a worker at all is always left to the caller from then on.
+ */
+#include "csapp.h"
+#include "cgiw.h"
+#define PROBE_PROVIDER tiny
+#include "probes.h"
+
+/* One worker process */
+typedef struct cgiw {
+    int fd;                          /* Our end of its socket, or -1 */
+    pid_t pid;
+    struct cgiw *next;               /* Next idle worker */
+} cgiw_t;
+
+/* The workers of one CGI program */
+typedef struct cgipool {
+    char *path;
+    cgiw_t *workers;
+    cgiw_t *idle;                    /* Idle workers */
+    sem_t avail;                     /* Counts idle workers */
+    sem_t mutex;                     /* Protects idle and noworker */
+    int noworker;                    /* Not a worker: don't start it */
+    struct cgipool *next;
+} cgipool_t;
+
+static int nworkers;                 /* Per program, 0 when off */
+static cgipool_t *pools;
+static sem_t pools_mutex;
+
+/*
+ * cgiw_init - Serve CGI programs with pools of nworkers workers each,
+ *     or with fork() and execve() per request if nworkers is 0
+ */
+void cgiw_init(int n)
+{
+    nworkers = n;
+    Sem_init(&pools_mutex, 0, 1);
+}
+
+int cgiw_enabled(void)
+{
+    return nworkers > 0;
+}
+
+/* pool_of - The pool for program path, created on first use */
+static cgipool_t *pool_of(char *path)
+{
+    cgipool_t *pp;
+    int i;
+
+    P(&pools_mutex);
+    for (pp = pools; pp && strcmp(pp->path, path); pp = pp->next)
+	;
+    if (!pp) {
+	pp = Malloc(sizeof(cgipool_t));
+	pp->path = strdup(path);
+	pp->workers = Calloc(nworkers, sizeof(cgiw_t));
+	pp->idle = NULL;
+	pp->noworker = 0;
+	for (i = 0; i < nworkers; i++) {
+	    pp->workers[i].fd = -1;
+	    pp->workers[i].next = pp->idle;
+	    pp->idle = &pp->workers[i];
+	}
+	Sem_init(&pp->avail, 0, nworkers);
+	Sem_init(&pp->mutex, 0, 1);
+	pp->next = pools;
+	pools = pp;
+    }
+    V(&pools_mutex);
+    return pp;
+}
+
+/* worker_stop - Shut down a failed worker and reap it */
+static void worker_stop(cgiw_t *w)
+{
+    close(w->fd);
+    w->fd = -1;
+    kill(w->pid, SIGKILL);
+    waitpid(w->pid, NULL, 0);
+}
+
+/* hello - Wait for worker w's CGIW_HELLO. Returns 0, or -1 */
+static int hello(cgiw_t *w)
+{
+    struct timeval tv = { CGIW_HELLO_MS / 1000, CGIW_HELLO_MS % 1000 * 1000 };
+    struct timeval none = { 0, 0 };
+    uint32_t word;
+
+    if (setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+	rio_readn(w->fd, &word, sizeof(word)) != sizeof(word) ||
+	word != CGIW_HELLO)
+	return -1;
+    return setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+}
+
+/*
+ * worker_start - Start program path as worker w. Returns 0, -1 if it
+ *     couldn't be started, or -2 if it isn't a worker
+ */
+static int worker_start(cgiw_t *w, char *path)
+{
+    int sv[2], i, devnull;
+    long maxfd = sysconf(_SC_OPEN_MAX);
+    char *argv[] = { path, CGIW_FLAG, NULL };
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+	return -1;
+    if ((w->pid = fork()) == 0) {
+	/* Keep only the socket: an inherited client connection would
+	   stay open, and its client waiting, as long as the worker lives.
+	   A classic CGI program's output goes nowhere */
+	dup2(sv[1], CGIW_FD);
+	if ((devnull = open("/dev/null", O_WRONLY)) >= 0)
+	    dup2(devnull, STDOUT_FILENO);
+	for (i = 3; i < maxfd; i++)
+	    close(i);
+	signal(SIGPIPE, SIG_DFL);    /* Tiny's SIG_IGN would survive execve */
+	execve(path, argv, environ);
+	_exit(127);
+    }
+    close(sv[1]);
+    if (w->pid < 0) {
+	close(sv[0]);
+	return -1;
+    }
+    w->fd = sv[0];
+    if (hello(w) < 0) {
+	worker_stop(w);
+	return -2;
+    }
+    return 0;
+}
+
+/*
+ * worker_call - Run one request on worker w. Returns the response in a
+ *     malloc'd buffer, and its length in *lenp, or NULL on failure.
+ */
+static char *worker_call(cgiw_t *w, char *cgiargs, uint32_t *lenp)
+{
+    uint32_t len = strlen(cgiargs);
+    char *out;
+
+    if (rio_writen(w->fd, &len, sizeof(len)) < 0 ||
+	rio_writen(w->fd, cgiargs, len) < 0 ||
+	rio_readn(w->fd, &len, sizeof(len)) != sizeof(len) ||
+	len > CGIW_MAXOUT)
+	return NULL;
+    out = Malloc(len ? len : 1);
+    if (rio_readn(w->fd, out, len) != len) {
+	Free(out);
+	return NULL;
+    }
+    *lenp = len;
+    return out;
+}
+
+/*
+ * cgiw_serve - Answer a request for CGI program filename with one of
+ *     its workers. Returns 0 once the response is sent, or -1, with
+ *     nothing sent, if no worker could produce it.
+ */
+int cgiw_serve(int fd, char *filename, char *cgiargs)
+{
+    static char status[] = "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n";
+    cgipool_t *pp = pool_of(filename);
+    cgiw_t *w;
+    char *out = NULL;
+    uint32_t len;
+    int rc = 0, noworker;
+
+    P(&pp->mutex);
+    noworker = pp->noworker;
+    V(&pp->mutex);
+    if (noworker)
+	return -1;
+
+    PROBE3(dynamic__start, fd, filename, cgiargs);
+    P(&pp->avail);
+    P(&pp->mutex);
+    w = pp->idle;
+    pp->idle = w->next;
+    V(&pp->mutex);
+
+    if (w->fd >= 0 || (rc = worker_start(w, filename)) == 0) {
+	if (!(out = worker_call(w, cgiargs, &len)))
+	    worker_stop(w);
+    }
+
+    P(&pp->mutex);
+    if (w->fd < 0 && rc == -2)
+	pp->noworker = 1;
+    w->next = pp->idle;
+    pp->idle = w;
+    V(&pp->mutex);
+    V(&pp->avail);
+
+    if (!out)
+	return -1;
+    Rio_writen(fd, status, sizeof(status) - 1);
+    Rio_writen(fd, out, len);
+    Free(out);
+    PROBE2(response__done, fd, 200);
+    return 0;
+}
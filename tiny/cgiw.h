@@ -0,0 +1,30 @@
+/*
+ * cgiw.h - Pools of persistent CGI worker processes
+ *
+ * A worker is a CGI program started as "prog -w" with a connected Unix
+ * stream socket on descriptor CGIW_FD. It first writes the uint32_t
+ * CGIW_HELLO, to show it speaks this protocol; a program that doesn't
+ * within CGIW_HELLO_MS is taken to be a classic CGI program, and is
+ * never started as a worker again. Then for each request Tiny sends a
+ * uint32_t length and that many bytes of query string; the worker
+ * answers with a uint32_t length and that many bytes of exactly what
+ * it would have written to stdout as a CGI program: headers, a blank
+ * line and the body. Lengths are in host byte order. A worker serves
+ * requests one at a time until it reads end of file.
+ */
+#ifndef __CGIW_H__
+#define __CGIW_H__
+
+#include "csapp.h"
+
+#define CGIW_FLAG   "-w"             /* argv[1] of a worker */
+#define CGIW_FD     0                /* Its socket to Tiny */
+#define CGIW_MAXOUT (1 << 20)        /* Largest response accepted */
+#define CGIW_HELLO  0x43474957u      /* "CGIW": a worker's first word */
+#define CGIW_HELLO_MS 1000           /* How long Tiny waits for it */
+
+void cgiw_init(int nworkers);
+int cgiw_enabled(void);
+int cgiw_serve(int fd, char *filename, char *cgiargs);
+
+#endif /* __CGIW_H__ */
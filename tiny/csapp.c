@@ -907,7 +907,8 @@ ssize_t Rio_readn(int fd, void *ptr, size_t nbytes)
 
 void Rio_writen(int fd, void *usrbuf, size_t n) 
 {
-    if (rio_writen(fd, usrbuf, n) != n)
+    /* A peer that went away is its own problem, not a fatal error */
+    if (rio_writen(fd, usrbuf, n) != n && errno != EPIPE && errno != ECONNRESET)
 	unix_error("Rio_writen error");
 }
 
@@ -929,8 +930,11 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 {
     ssize_t rc;
 
-    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
-	unix_error("Rio_readlineb error");
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0) {
+	if (errno != ECONNRESET)
+	    unix_error("Rio_readlineb error");
+	rc = 0;                  /* Treat a reset like end of file */
+    }
     return rc;
 } 
 
@@ -0,0 +1,239 @@
+/*
+ * fcache.c - Cache of open static files and their response headers
+ *
+ * A hit hands out an open descriptor, the file's size and the headers
+ * of its 200 response, so a hot file costs no stat(), open() or header
+ * formatting. The cache holds at most maxentries files and drops the
+ * least recently used one to make room.
+ *
+ * Entries are kept fresh with inotify: each cached file is watched,
+ * and a thread drops an entry as soon as its file is written, has its
+ * attributes or links changed (chmod, unlink, rename over it) or goes
+ * away. Where a watch can't be had (no inotify, or out of watches) the
+ * entry is checked with stat() against its size, mtime and inode on
+ * every hit instead.
+ *
+ * Entries are reference counted, so one can be dropped while another
+ * thread is still sending from its descriptor.
+ */
+#include "csapp.h"
+#include <sys/inotify.h>
+#include "fcache.h"
+
+#define FCACHE_NBUCKETS 256
+#define FCACHE_EVENTS   (IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static fentry_t *buckets[FCACHE_NBUCKETS];
+static fentry_t lru = { .prev = &lru, .next = &lru };  /* Sentinel */
+static int nentries, maxentries;
+static int ifd = -1;                 /* inotify instance, or -1 */
+
+static unsigned long hash(const char *s)
+{
+    unsigned long h = 14695981039346656037UL;
+
+    while (*s) {
+	h ^= (unsigned char)*s++;
+	h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static fentry_t **bucket_of(const char *path)
+{
+    return &buckets[hash(path) % FCACHE_NBUCKETS];
+}
+
+/* entry_put - Drop a reference, freeing fe with the last one */
+static void entry_put(fentry_t *fe)
+{
+    if (--fe->refcnt > 0)
+	return;
+    close(fe->fd);
+    Free(fe->path);
+    Free(fe->hdrs);
+    Free(fe);
+}
+
+/*
+ * unwatch - Drop watch wd, unless it belongs to a cached entry: links
+ *     to one file share its watch. Caller holds mutex.
+ */
+static void unwatch(int wd)
+{
+    fentry_t *fe;
+
+    if (wd < 0)
+	return;
+    for (fe = lru.next; fe != &lru; fe = fe->next)
+	if (fe->wd == wd)
+	    return;
+    inotify_rm_watch(ifd, wd);
+}
+
+/* entry_remove - Take fe out of the cache. Caller holds mutex */
+static void entry_remove(fentry_t *fe)
+{
+    fentry_t **pp;
+
+    for (pp = bucket_of(fe->path); *pp != fe; pp = &(*pp)->hnext)
+	;
+    *pp = fe->hnext;
+    fe->prev->next = fe->next;
+    fe->next->prev = fe->prev;
+    nentries--;
+    unwatch(fe->wd);
+    entry_put(fe);
+}
+
+/* watcher - Thread routine: drop the entries of files that change */
+static void *watcher(void *vargp)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    fentry_t *fe, *next;
+    ssize_t n;
+    char *p;
+
+    Pthread_detach(pthread_self());
+    while ((n = read(ifd, buf, sizeof(buf))) > 0 || errno == EINTR) {
+	pthread_mutex_lock(&mutex);
+	for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *)p;
+	    for (fe = lru.next; fe != &lru; fe = next) {
+		next = fe->next;
+		if (fe->wd == ev->wd)
+		    entry_remove(fe);
+	    }
+	}
+	pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+/*
+ * fcache_init - Cache up to max files (0 turns the cache off) and
+ *     start watching for changes
+ */
+void fcache_init(int max)
+{
+    pthread_t tid;
+
+    maxentries = max;
+    if (max > 0 && (ifd = inotify_init1(IN_CLOEXEC)) >= 0)
+	Pthread_create(&tid, NULL, watcher, NULL);
+}
+
+/*
+ * fcache_lookup - Return a referenced entry for path, or NULL on a
+ *     miss. Release it with fcache_release() when done.
+ */
+fentry_t *fcache_lookup(const char *path)
+{
+    fentry_t *fe;
+    struct stat st;
+
+    if (maxentries == 0)
+	return NULL;
+    pthread_mutex_lock(&mutex);
+    for (fe = *bucket_of(path); fe && strcmp(fe->path, path); fe = fe->hnext)
+	;
+    if (fe && fe->wd < 0 &&          /* Unwatched: check it by hand */
+	(stat(path, &st) < 0 || st.st_size != fe->size ||
+	 st.st_ino != fe->ino || st.st_mtim.tv_sec != fe->mtime.tv_sec ||
+	 st.st_mtim.tv_nsec != fe->mtime.tv_nsec ||
+	 !S_ISREG(st.st_mode) || !(S_IRUSR & st.st_mode))) {
+	entry_remove(fe);
+	fe = NULL;
+    }
+    if (fe) {
+	fe->prev->next = fe->next;   /* Move to the head of the LRU list */
+	fe->next->prev = fe->prev;
+	fe->next = lru.next;
+	fe->prev = &lru;
+	lru.next->prev = fe;
+	lru.next = fe;
+	fe->refcnt++;
+    }
+    pthread_mutex_unlock(&mutex);
+    return fe;
+}
+
+/*
+ * fcache_release - Drop a reference obtained from fcache_lookup
+ */
+void fcache_release(fentry_t *fe)
+{
+    pthread_mutex_lock(&mutex);
+    entry_put(fe);
+    pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * fcache_insert - Cache fd, open on path and size bytes long, with the
+ *     headers of its response and whether path.gz, its gzip variant,
+ *     exists. The variant isn't watched: one added later is only seen
+ *     once path's own entry is dropped. On success the cache owns fd
+ *     and returns 0; otherwise (cache off, path already cached, or the file
+ *     changed since size was taken) it returns -1 and fd stays the
+ *     caller's.
+ */
+int fcache_insert(const char *path, int fd, off_t size, const char *hdrs,
+		  size_t hdrlen, int gz)
+{
+    fentry_t *fe, **bp;
+    struct stat st, pst;
+    int wd = -1;
+
+    if (maxentries == 0 || fstat(fd, &st) < 0 || st.st_size != size)
+	return -1;
+    if (ifd >= 0)
+	wd = inotify_add_watch(ifd, path, FCACHE_EVENTS);
+
+    fe = Malloc(sizeof(fentry_t));
+    fe->path = strdup(path);
+    fe->fd = fd;
+    fe->size = size;
+    fe->mtime = st.st_mtim;
+    fe->ino = st.st_ino;
+    fe->wd = wd;
+    fe->hdrs = Malloc(hdrlen);
+    memcpy(fe->hdrs, hdrs, hdrlen);
+    fe->hdrlen = hdrlen;
+    fe->gz = gz;
+    fe->refcnt = 1;
+
+    /*
+     * Check that path is still the file we opened, unchanged, with the
+     * watcher locked out: a change before this is seen here, and the
+     * event for one after it is handled once the entry is in place.
+     */
+    pthread_mutex_lock(&mutex);
+    bp = bucket_of(path);
+    for (fe->hnext = *bp; fe->hnext; fe->hnext = fe->hnext->hnext)
+	if (!strcmp(fe->hnext->path, path))
+	    break;
+    if (fe->hnext ||                 /* Another thread cached it first */
+	stat(path, &pst) < 0 || pst.st_ino != st.st_ino ||
+	pst.st_dev != st.st_dev || pst.st_size != st.st_size ||
+	pst.st_mtim.tv_sec != st.st_mtim.tv_sec ||
+	pst.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+	unwatch(wd);
+	pthread_mutex_unlock(&mutex);
+	fe->fd = -1;
+	entry_put(fe);
+	return -1;
+    }
+    while (nentries >= maxentries)
+	entry_remove(lru.prev);
+    fe->hnext = *bp;
+    *bp = fe;
+    fe->next = lru.next;
+    fe->prev = &lru;
+    lru.next->prev = fe;
+    lru.next = fe;
+    nentries++;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * fcache.h - Cache of open static files and their response headers
+ */
+#ifndef __FCACHE_H__
+#define __FCACHE_H__
+
+#include "csapp.h"
+
+#define FCACHE_MAXENTRIES 256        /* Default bound on cached files */
+
+/* A cached file. Users hold a reference while they send it */
+typedef struct fentry {
+    char *path;                      /* Key: file name as served */
+    int fd;                          /* Open for reading */
+    off_t size;
+    struct timespec mtime;
+    ino_t ino;
+    int wd;                          /* inotify watch, or -1 */
+    char *hdrs;                      /* Response headers for a GET */
+    size_t hdrlen;
+    int gz;                          /* path.gz existed when cached */
+    int refcnt;                      /* Users, plus one while cached */
+    struct fentry *hnext;            /* Hash chain */
+    struct fentry *prev, *next;      /* LRU list, newest first */
+} fentry_t;
+
+void fcache_init(int maxentries);
+fentry_t *fcache_lookup(const char *path);
+void fcache_release(fentry_t *fe);
+int fcache_insert(const char *path, int fd, off_t size, const char *hdrs,
+		  size_t hdrlen, int gz);
+
+#endif /* __FCACHE_H__ */
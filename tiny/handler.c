@@ -0,0 +1,145 @@
+/*
+ * handler.c - Loader for in-process dynamic content handlers
+ *
+ * A handler is loaded with dlopen() on first use and kept loaded.
+ * Every request passes in the stat() of its file, and when that no
+ * longer matches the loaded file (rebuilt, replaced or touched) the
+ * new version is loaded and takes over; the old one is unloaded once
+ * the last request still running it finishes.
+ *
+ * dlopen() hands back the library already loaded for a file it has
+ * seen before, even one since rewritten in place, and a library
+ * rewritten under a running server crashes it. So each version is
+ * loaded from a private copy, removed as soon as it is mapped.
+ */
+#include "csapp.h"
+#include <dlfcn.h>
+#include "handler.h"
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static hmod_t *mods;                 /* Current version of each handler */
+
+/* same_file - Are a and b the stat() of one version of one file? */
+static int same_file(struct stat *a, struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * copy_file - Copy path to a new temporary file, and its stat() to
+ *     *st. Returns the new file's name, or NULL.
+ */
+static char *copy_file(const char *path, struct stat *st)
+{
+    char tmp[] = "/tmp/tiny-handler.XXXXXX", buf[MAXBUF];
+    int in, out = -1;
+    ssize_t n = -1;
+
+    if ((in = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	return NULL;
+    if (fstat(in, st) == 0 && (out = mkstemp(tmp)) >= 0) {
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+	    if (rio_writen(out, buf, n) < 0)
+		break;
+	close(out);
+	if (n != 0)
+	    unlink(tmp);
+    }
+    close(in);
+    return out >= 0 && n == 0 ? strdup(tmp) : NULL;
+}
+
+/* load - Load the current version of path, or return NULL */
+static hmod_t *load(const char *path)
+{
+    struct stat st;
+    hmod_t *hm;
+    char *copy;
+    void *dl;
+    hfunc_t *fn;
+
+    if (!(copy = copy_file(path, &st))) {
+	fprintf(stderr, "tiny: can't copy %s: %s\n", path, strerror(errno));
+	return NULL;
+    }
+    dl = dlopen(copy, RTLD_NOW | RTLD_LOCAL);
+    unlink(copy);
+    Free(copy);
+    if (!dl || !(fn = (hfunc_t *)dlsym(dl, HANDLER_SYM))) {
+	fprintf(stderr, "tiny: can't load %s: %s\n", path, dlerror());
+	if (dl)
+	    dlclose(dl);
+	return NULL;
+    }
+
+    hm = Malloc(sizeof(hmod_t));
+    hm->path = strdup(path);
+    hm->st = st;
+    hm->dl = dl;
+    hm->fn = fn;
+    hm->refcnt = 1;
+    return hm;
+}
+
+/* put - Drop a reference, unloading hm with the last one. Caller holds mutex */
+static void put(hmod_t *hm)
+{
+    if (--hm->refcnt > 0)
+	return;
+    dlclose(hm->dl);
+    Free(hm->path);
+    Free(hm);
+}
+
+/*
+ * handler_get - Return a referenced handler for path, whose stat() is
+ *     st, loading or reloading it as needed, or NULL if it won't load.
+ *     Release it with handler_put() when done.
+ */
+hmod_t *handler_get(const char *path, struct stat *st)
+{
+    hmod_t *hm, *nhm, **pp;
+
+    pthread_mutex_lock(&mutex);
+    for (hm = mods; hm && strcmp(hm->path, path); hm = hm->next)
+	;
+    if (hm && same_file(&hm->st, st)) {
+	hm->refcnt++;
+	pthread_mutex_unlock(&mutex);
+	return hm;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    /* Load outside the lock: other handlers keep running meanwhile */
+    if (!(nhm = load(path)))
+	return NULL;
+
+    pthread_mutex_lock(&mutex);
+    for (pp = &mods; *pp && strcmp((*pp)->path, path); pp = &(*pp)->next)
+	;
+    if ((hm = *pp) && same_file(&hm->st, &nhm->st)) {
+	put(nhm);                    /* Another thread loaded it first */
+    }
+    else {
+	nhm->next = hm ? hm->next : NULL;
+	*pp = nhm;
+	if (hm)
+	    put(hm);                 /* Retire the old version */
+	hm = nhm;
+    }
+    hm->refcnt++;
+    pthread_mutex_unlock(&mutex);
+    return hm;
+}
+
+/*
+ * handler_put - Drop a reference obtained from handler_get
+ */
+void handler_put(hmod_t *hm)
+{
+    pthread_mutex_lock(&mutex);
+    put(hm);
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,35 @@
+/*
+ * handler.h - In-process dynamic content handlers
+ *
+ * A handler is a shared object under cgi-bin/ ("cgi-bin/adder.so")
+ * that exports HANDLER_SYM, a function of type hfunc_t. Tiny calls
+ * it with the request's query string, and the handler produces what a
+ * CGI program would print on stdout (headers, a blank line and the
+ * body) by calling write(ctx, ...) as often as it likes. It returns 0
+ * on success; anything else gets the client a 500 instead. Handlers
+ * run on Tiny's threads, so they must be thread safe.
+ */
+#ifndef __HANDLER_H__
+#define __HANDLER_H__
+
+#include "csapp.h"
+
+#define HANDLER_SYM "tiny_handler"
+
+typedef void hwrite_t(void *ctx, const void *buf, size_t len);
+typedef int hfunc_t(const char *query, hwrite_t *write, void *ctx);
+
+/* A loaded handler. Users hold a reference while they call it */
+typedef struct hmod {
+    char *path;                      /* Key: file name as served */
+    struct stat st;                  /* Of the loaded file */
+    void *dl;                        /* From dlopen() */
+    hfunc_t *fn;
+    int refcnt;                      /* Users, plus one while current */
+    struct hmod *next;
+} hmod_t;
+
+hmod_t *handler_get(const char *path, struct stat *st);
+void handler_put(hmod_t *hm);
+
+#endif /* __HANDLER_H__ */
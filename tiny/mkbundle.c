@@ -0,0 +1,185 @@
+/*
+ * mkbundle - Pack a document root into a bundle for "tiny -b"
+ *
+ * usage: mkbundle <dir> <bundle>
+ *
+ * Packs every regular file under dir, following symbolic links, as
+ * "./path/under/dir". CGI programs are not packed: cgi-bin directories
+ * are skipped, as is bundle itself. Files go in sorted by path and no
+ * times or owners are recorded, so the same tree always packs to the
+ * same bytes. The bundle is written to a temporary file and renamed
+ * into place, so a running Tiny keeps its old copy intact.
+ */
+#include "csapp.h"
+#include <dirent.h>
+#include "bundle.h"
+
+#define ALIGN(x) (((x) + 7) & ~(uint64_t)7)  /* Contents are 8-byte aligned */
+
+typedef struct {
+    char *path;                      /* As served: "./dir/file" */
+    char *file;                      /* Where it is now */
+    uint64_t size;
+} file_t;
+
+static file_t *files;
+static int nfiles, filecap;
+static struct stat outst;            /* The old bundle, if any */
+static int have_out;
+
+static int cmpname(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+static int cmpfile(const void *a, const void *b)
+{
+    return strcmp(((file_t *)a)->path, ((file_t *)b)->path);
+}
+
+/* walk - Add the files under directory dir, served as prefix/... */
+static void walk(const char *dir, const char *prefix)
+{
+    DIR *dp;
+    struct dirent *de;
+    struct stat st;
+    char **names = NULL, file[MAXLINE], path[MAXLINE];
+    int n = 0, cap = 0, i;
+
+    if (!(dp = opendir(dir))) {
+	fprintf(stderr, "mkbundle: %s: %s\n", dir, strerror(errno));
+	exit(1);
+    }
+    while ((de = readdir(dp)) != NULL) {
+	if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+	    continue;
+	if (n == cap) {
+	    cap = cap ? 2 * cap : 64;
+	    names = Realloc(names, cap * sizeof(char *));
+	}
+	names[n++] = strdup(de->d_name);
+    }
+    closedir(dp);
+    qsort(names, n, sizeof(char *), cmpname);
+
+    for (i = 0; i < n; i++) {
+	if (snprintf(file, MAXLINE, "%s/%s", dir, names[i]) >= MAXLINE ||
+	    snprintf(path, MAXLINE, "%s/%s", prefix, names[i]) >= MAXLINE) {
+	    fprintf(stderr, "mkbundle: %s/%s: name too long\n", dir, names[i]);
+	    exit(1);
+	}
+	if (stat(file, &st) < 0) {
+	    fprintf(stderr, "mkbundle: %s: %s\n", file, strerror(errno));
+	    exit(1);
+	}
+	if (S_ISDIR(st.st_mode) && strcmp(names[i], "cgi-bin"))
+	    walk(file, path);
+	else if (S_ISREG(st.st_mode) && !(have_out &&
+		 st.st_dev == outst.st_dev && st.st_ino == outst.st_ino)) {
+	    if (nfiles == filecap) {
+		filecap = filecap ? 2 * filecap : 256;
+		files = Realloc(files, filecap * sizeof(file_t));
+	    }
+	    files[nfiles].path = strdup(path);
+	    files[nfiles].file = strdup(file);
+	    files[nfiles].size = st.st_size;
+	    nfiles++;
+	}
+	Free(names[i]);
+    }
+    Free(names);
+}
+
+/* copy - Append file f, which must still be f->size bytes, to outfd */
+static void copy(int outfd, file_t *f)
+{
+    char buf[MAXBUF];
+    uint64_t left = f->size;
+    ssize_t n;
+    int fd = Open(f->file, O_RDONLY, 0);
+
+    while (left > 0 &&
+	   (n = Read(fd, buf, left < MAXBUF ? left : MAXBUF)) > 0) {
+	Rio_writen(outfd, buf, n);
+	left -= n;
+    }
+    if (left > 0 || Read(fd, buf, 1) != 0) {
+	fprintf(stderr, "mkbundle: %s changed while being packed\n", f->file);
+	exit(1);
+    }
+    Close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    bundle_hdr_t hdr;
+    bundle_rec_t *recs;
+    uint32_t *slots, nslots, i;
+    uint64_t off, total = 0;
+    char tmp[MAXLINE], zero[8] = { 0 };
+    int fd, k;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <dir> <bundle>\n", argv[0]);
+	exit(1);
+    }
+    have_out = stat(argv[2], &outst) == 0;
+    walk(argv[1], ".");
+    qsort(files, nfiles, sizeof(file_t), cmpfile);
+
+    /* Lay out the index, then the paths, then the contents */
+    for (nslots = 8; nslots < 2 * (uint32_t)nfiles; nslots *= 2)
+	;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BUNDLE_MAGIC, sizeof(hdr.magic));
+    hdr.nentries = nfiles;
+    hdr.nslots = nslots;
+    recs = Calloc(nfiles ? nfiles : 1, sizeof(bundle_rec_t));
+    slots = Calloc(nslots, sizeof(uint32_t));
+    off = sizeof(hdr) + nfiles * sizeof(bundle_rec_t) +
+	nslots * sizeof(uint32_t);
+    for (k = 0; k < nfiles; k++) {
+	recs[k].path = off;
+	off += strlen(files[k].path) + 1;
+    }
+    for (k = 0; k < nfiles; k++) {
+	off = ALIGN(off);
+	recs[k].data = off;
+	recs[k].size = files[k].size;
+	off += files[k].size;
+	total += files[k].size;
+	for (i = bundle_hash(files[k].path) & (nslots - 1); slots[i];
+	     i = (i + 1) & (nslots - 1))
+	    ;
+	slots[i] = k + 1;
+    }
+
+    snprintf(tmp, MAXLINE, "%s.XXXXXX", argv[2]);
+    if ((fd = mkstemp(tmp)) < 0) {
+	fprintf(stderr, "mkbundle: %s: %s\n", tmp, strerror(errno));
+	exit(1);
+    }
+    Rio_writen(fd, &hdr, sizeof(hdr));
+    Rio_writen(fd, recs, nfiles * sizeof(bundle_rec_t));
+    Rio_writen(fd, slots, nslots * sizeof(uint32_t));
+    off = sizeof(hdr) + nfiles * sizeof(bundle_rec_t) +
+	nslots * sizeof(uint32_t);
+    for (k = 0; k < nfiles; k++) {
+	Rio_writen(fd, files[k].path, strlen(files[k].path) + 1);
+	off += strlen(files[k].path) + 1;
+    }
+    for (k = 0; k < nfiles; k++) {
+	Rio_writen(fd, zero, ALIGN(off) - off);
+	copy(fd, &files[k]);
+	off = ALIGN(off) + files[k].size;
+    }
+    if (fchmod(fd, 0644) < 0 || fsync(fd) < 0 || rename(tmp, argv[2]) < 0) {
+	fprintf(stderr, "mkbundle: %s: %s\n", argv[2], strerror(errno));
+	unlink(tmp);
+	exit(1);
+    }
+    Close(fd);
+    printf("%s: %d files, %llu bytes\n", argv[2], nfiles,
+	   (unsigned long long)total);
+    return 0;
+}
@@ -1,48 +1,260 @@
 /* $begin tinymain */
 /*
- * tiny.c - A simple, iterative HTTP/1.0 Web server that uses the 
- *     GET method to serve static and dynamic content.
+ * tiny.c - A simple HTTP/1.0 Web server that uses the GET method
+ *     to serve static and dynamic content.
+ *
+ * Static content may also be asked for with HEAD, for its headers
+ * alone, and a GET with a single byte Range ("bytes=0-99", "bytes=100-"
+ * or "bytes=-100") gets just that part of the file as a 206.
+ *
+ * A client that accepts gzip is sent file.gz in place of file when
+ * there is one (see "make precompress"), with Content-encoding: gzip.
+ * Every response for such a file, either way, has Vary: Accept-Encoding.
+ *
+ * A CGI program's output goes to an HTTP/1.0 client directly, but to an
+ * HTTP/1.1 client through Tiny, which sends it on as it is produced,
+ * with chunked transfer coding when the program gives no Content-length.
  *
  * Updated 11/2019 droh 
  *   - Fixed sprintf() aliasing issue in serve_static(), and clienterror().
+ *
+ * By default Tiny is iterative and serves one connection at a time.
+ * With -t N it is prethreaded instead: the main thread accepts
+ * connections and N worker threads take them from a bounded buffer
+ * (see sbuf.c) and serve them, so a slow client holds up only its own
+ * worker. With -e an epoll loop sits between the two: accepted
+ * connections wait in it until their request arrives and only then go
+ * to a worker, so idle clients tie up no thread at all.
+ *
+ * Static files are served from a cache of open descriptors and
+ * prebuilt headers (see fcache.c), so a hot file costs no stat() or
+ * open(). -c sets how many files it holds; -c 0 turns it off.
+ *
+ * With -w N each CGI program is run as a pool of N persistent workers
+ * (see cgiw.c) instead of being forked and executed for every request;
+ * a request the pool can't answer falls back to fork() and execve().
+ * A request for a shared object under cgi-bin ("cgi-bin/adder.so")
+ * runs no program at all: the object is loaded into Tiny and called
+ * in place (see handler.c), and reloaded whenever its file changes.
+ *
+ * With -b bundle, static content comes from an archive of the document
+ * root made by mkbundle (see bundle.c) instead of the file system: it
+ * is mapped once at startup, with every response's headers built then,
+ * and requests are answered straight from memory.
+ *
+ * USDT probes (see probes.h) under the "tiny" provider mark each
+ * request's accept, parse, start of service and completion. All take
+ * the connected descriptor as their first argument.
  */
 #include "csapp.h"
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include "sbuf.h"
+#include "fcache.h"
+#include "cgiw.h"
+#include "handler.h"
+#include "bundle.h"
+#include "mime.h"
+#define PROBE_PROVIDER tiny
+#include "probes.h"
+
+#define NTHREADS  16    /* Workers for -e without -t */
+#define SBUFSIZE  64    /* Connections waiting for a worker */
+#define MAXEVENTS 64    /* Events per epoll_wait() */
+
+static sbuf_t connq;    /* Connections ready to be served */
+
+/* What a request asks of a static file, besides its name */
+typedef struct {
+    int head;                        /* HEAD: the headers only */
+    int gzip;                        /* Accepts gzip content coding */
+    char range[MAXLINE];             /* Range header, or "" */
+} sreq_t;
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+void read_requesthdrs(rio_t *rp, sreq_t *sr);
+int accepts_gzip(char *value);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize);
+int parse_range(char *range, off_t size, off_t *first, off_t *last);
+int is_handler(char *filename);
+int gzip_variant(char *filename, char *gzname, struct stat *sbuf);
+int serve_gzip(int fd, char *filename, sreq_t *sr);
+void serve_static(int fd, char *filename, off_t filesize, sreq_t *sr,
+		  int gz);
+void cache_static(char *filename, off_t filesize);
+size_t static_headers(char *buf, const char *filename, off_t filesize,
+		      int gz, int vary, int partial, off_t first, off_t last);
+size_t bundle_headers(char *buf, const char *path, off_t size, int gz,
+		      int vary);
+void range_error(int fd, off_t filesize);
+int send_file(int outfd, int infd, off_t off, off_t len);
+void serve_cached(int fd, fentry_t *fe, sreq_t *sr, int gz);
+void serve_bundle(int fd, bentry_t *be, sreq_t *sr);
+int send_mem(int fd, const char *hdrs, size_t hdrlen, const char *body,
+	     size_t len);
 void get_filetype(char *filename, char *filetype);
-void serve_dynamic(int fd, char *filename, char *cgiargs);
+void serve_dynamic(int fd, char *filename, char *cgiargs, int http11);
+int relay_cgi(int fd, int cgifd);
+void serve_handler(int fd, char *filename, char *cgiargs, struct stat *sbuf);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
+void serve_concurrent(int listenfd, int nthreads, int useepoll);
 
 int main(int argc, char **argv) 
 {
-    int listenfd, connfd;
-    char hostname[MAXLINE], port[MAXLINE];
+    int listenfd, connfd, c, nthreads = 0, useepoll = 0;
+    int ncache = FCACHE_MAXENTRIES, ncgiw = 0;
+    char *bundle = NULL, hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
 
     /* Check command line args */
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    while ((c = getopt(argc, argv, "t:ec:w:b:")) != -1) {
+	if (c == 't' && (nthreads = atoi(optarg)) > 0)
+	    continue;
+	if (c == 'c' && (ncache = atoi(optarg)) >= 0)
+	    continue;
+	if (c == 'w' && (ncgiw = atoi(optarg)) >= 0)
+	    continue;
+	if (c == 'e') {
+	    useepoll = 1;
+	    continue;
+	}
+	if (c == 'b') {
+	    bundle = optarg;
+	    continue;
+	}
+	optind = argc;  /* Force the usage message */
+	break;
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr, "usage: %s [-t nthreads] [-e] [-c cached-files] "
+		"[-w cgi-workers] [-b bundle] <port>\n", argv[0]);
 	exit(1);
     }
 
-    listenfd = Open_listenfd(argv[1]);
+    /* A client that hangs up early must not take the server with it.
+       CGI programs get the default back: see serve_dynamic and cgiw.c */
+    Signal(SIGPIPE, SIG_IGN);
+    fcache_init(ncache);
+    cgiw_init(ncgiw);
+    if (bundle && bundle_open(bundle, bundle_headers) < 0)
+	exit(1);
+    listenfd = Open_listenfd(argv[optind]);
+    if (nthreads > 0 || useepoll)
+	serve_concurrent(listenfd, nthreads > 0 ? nthreads : NTHREADS,
+			 useepoll);
     while (1) {
 	clientlen = sizeof(clientaddr);
 	connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); //line:netp:tiny:accept
         Getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE, 
                     port, MAXLINE, 0);
         printf("Accepted connection from (%s, %s)\n", hostname, port);
+	PROBE1(accept, connfd);
 	doit(connfd);                                             //line:netp:tiny:doit
 	Close(connfd);                                            //line:netp:tiny:close
     }
 }
 /* $end tinymain */
 
+/*
+ * accept_conn - Accept a connection on listenfd and log it. Returns
+ *     the connected descriptor, or -1.
+ */
+int accept_conn(int listenfd)
+{
+    int connfd;
+    char hostname[MAXLINE], port[MAXLINE];
+    socklen_t clientlen = sizeof(struct sockaddr_storage);
+    struct sockaddr_storage clientaddr;
+
+    if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0)
+	return -1;
+    /* No reverse lookups: they would serialize every accept */
+    if (getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port,
+		    MAXLINE, NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+	printf("Accepted connection from (%s, %s)\n", hostname, port);
+    PROBE1(accept, connfd);
+    return connfd;
+}
+
+/*
+ * thread - worker thread routine: serve connections from connq
+ */
+void *thread(void *vargp)
+{
+    int connfd;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+	connfd = sbuf_remove(&connq);
+	doit(connfd);
+	Close(connfd);
+    }
+    return NULL;
+}
+
+/*
+ * epoll_loop - Hold accepted connections until their request arrives,
+ *     then hand them to the workers. Never returns.
+ */
+void epoll_loop(int listenfd)
+{
+    int epfd, connfd, n, i;
+    struct epoll_event ev, events[MAXEVENTS];
+
+    if ((epfd = epoll_create1(0)) < 0)
+	unix_error("epoll_create1 error");
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+	unix_error("epoll_ctl error");
+
+    while (1) {
+	if ((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("epoll_wait error");
+	}
+	for (i = 0; i < n; i++) {
+	    if (events[i].data.fd == listenfd) {
+		if ((connfd = accept_conn(listenfd)) < 0)
+		    continue;
+		ev.events = EPOLLIN;
+		ev.data.fd = connfd;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+		    Close(connfd);
+	    }
+	    else {   /* Request (or hangup) has arrived */
+		connfd = events[i].data.fd;
+		epoll_ctl(epfd, EPOLL_CTL_DEL, connfd, NULL);
+		sbuf_insert(&connq, connfd);
+	    }
+	}
+    }
+}
+
+/*
+ * serve_concurrent - Serve connections on listenfd with nthreads
+ *     workers, fed directly or through the epoll loop. Never returns.
+ */
+void serve_concurrent(int listenfd, int nthreads, int useepoll)
+{
+    int i, connfd;
+    pthread_t tid;
+
+    sbuf_init(&connq, SBUFSIZE);
+    for (i = 0; i < nthreads; i++)
+	Pthread_create(&tid, NULL, thread, NULL);
+    if (useepoll)
+	epoll_loop(listenfd);
+    while (1) {
+	if ((connfd = accept_conn(listenfd)) >= 0)
+	    sbuf_insert(&connq, connfd);
+    }
+}
+
 /*
  * doit - handle one HTTP request/response transaction
  */
@@ -53,23 +265,53 @@ void doit(int fd)
     struct stat sbuf;
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char filename[MAXLINE], cgiargs[MAXLINE];
+    sreq_t sr;
     rio_t rio;
+    fentry_t *fe;
+    bentry_t *be;
 
     /* Read request line and headers */
     Rio_readinitb(&rio, fd);
     if (!Rio_readlineb(&rio, buf, MAXLINE))  //line:netp:doit:readrequest
         return;
     printf("%s", buf);
-    sscanf(buf, "%s %s %s", method, uri, version);       //line:netp:doit:parserequest
-    if (strcasecmp(method, "GET")) {                     //line:netp:doit:beginrequesterr
+    version[0] = '\0';                    /* No version: HTTP/1.0 or older */
+    if (sscanf(buf, "%s %s %s", method, uri, version) < 2) { //line:netp:doit:parserequest
+        clienterror(fd, buf, "400", "Bad Request",
+                    "Tiny couldn't parse the request line");
+        return;
+    }
+    PROBE3(request__parsed, fd, method, uri);
+    sr.head = !strcasecmp(method, "HEAD");
+    if (strcasecmp(method, "GET") && !sr.head) {            //line:netp:doit:beginrequesterr
         clienterror(fd, method, "501", "Not Implemented",
                     "Tiny does not implement this method");
         return;
     }                                                    //line:netp:doit:endrequesterr
-    read_requesthdrs(&rio);                              //line:netp:doit:readrequesthdrs
+    read_requesthdrs(&rio, &sr);                         //line:netp:doit:readrequesthdrs
 
     /* Parse URI from GET request */
     is_static = parse_uri(uri, filename, cgiargs);       //line:netp:doit:staticcheck
+    if (!is_static && sr.head) {
+        clienterror(fd, method, "501", "Not Implemented",
+                    "Tiny does not implement HEAD for dynamic content");
+        return;
+    }
+    if (is_static && bundle_enabled()) {   /* All static files are bundled */
+	if ((be = bundle_lookup(filename)) != NULL)
+	    serve_bundle(fd, be, &sr);
+	else
+	    clienterror(fd, filename, "404", "Not found",
+			"Tiny couldn't find this file");
+	return;
+    }
+    if (is_static && (fe = fcache_lookup(filename))) {  /* Hot, and checked */
+	if (sr.gzip && fe->gz && serve_gzip(fd, filename, &sr))
+	    fcache_release(fe);
+	else
+	    serve_cached(fd, fe, &sr, 0);
+	return;
+    }
     if (stat(filename, &sbuf) < 0) {                     //line:netp:doit:beginnotfound
 	clienterror(fd, filename, "404", "Not found",
 		    "Tiny couldn't find this file");
@@ -82,7 +324,18 @@ void doit(int fd)
 			"Tiny couldn't read the file");
 	    return;
 	}
-	serve_static(fd, filename, sbuf.st_size);        //line:netp:doit:servestatic
+	if (sr.gzip && serve_gzip(fd, filename, &sr))  /* Only once it passes */
+	    cache_static(filename, sbuf.st_size);  /* Spare the next a stat */
+	else
+	    serve_static(fd, filename, sbuf.st_size, &sr, 0); //line:netp:doit:servestatic
+    }
+    else if (is_handler(filename)) { /* Serve from a loaded handler */
+	if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
+	    clienterror(fd, filename, "403", "Forbidden",
+			"Tiny couldn't read the handler");
+	    return;
+	}
+	serve_handler(fd, filename, cgiargs, &sbuf);
     }
     else { /* Serve dynamic content */
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) { //line:netp:doit:executable
@@ -90,29 +343,69 @@ void doit(int fd)
 			"Tiny couldn't run the CGI program");
 	    return;
 	}
-	serve_dynamic(fd, filename, cgiargs);            //line:netp:doit:servedynamic
+	if (!cgiw_enabled() || cgiw_serve(fd, filename, cgiargs) < 0)
+	    serve_dynamic(fd, filename, cgiargs,
+			  !strcasecmp(version, "HTTP/1.1")); //line:netp:doit:servedynamic
     }
 }
 /* $end doit */
 
 /*
- * read_requesthdrs - read HTTP request headers
+ * read_requesthdrs - read HTTP request headers, noting in sr the
+ *     Range asked for and whether gzip is acceptable
  */
 /* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+void read_requesthdrs(rio_t *rp, sreq_t *sr) 
 {
-    char buf[MAXLINE];
+    char buf[MAXLINE], *p;
+    int ifrange = 0;
 
-    Rio_readlineb(rp, buf, MAXLINE);
+    sr->gzip = 0;
+    *sr->range = '\0';
+    if (Rio_readlineb(rp, buf, MAXLINE) <= 0)
+	return;
     printf("%s", buf);
     while(strcmp(buf, "\r\n")) {          //line:netp:readhdrs:checkterm
-	Rio_readlineb(rp, buf, MAXLINE);
+	if (!strncasecmp(buf, "Range:", 6)) {
+	    for (p = buf + 6; *p == ' ' || *p == '\t'; p++)
+		;
+	    strcpy(sr->range, p);
+	    sr->range[strcspn(sr->range, " \t\r\n")] = '\0';
+	}
+	else if (!strncasecmp(buf, "If-Range:", 9))
+	    ifrange = 1;
+	else if (!strncasecmp(buf, "Accept-Encoding:", 16))
+	    sr->gzip = accepts_gzip(buf + 16);
+	if (Rio_readlineb(rp, buf, MAXLINE) <= 0)  /* Client hung up */
+	    return;
 	printf("%s", buf);
     }
+    if (ifrange)   /* Tiny sends no validators, so none can match */
+	*sr->range = '\0';
     return;
 }
 /* $end read_requesthdrs */
 
+/*
+ * accepts_gzip - does Accept-Encoding value list gzip (or x-gzip)
+ *     with a nonzero quality?
+ */
+int accepts_gzip(char *value)
+{
+    char buf[MAXLINE], *tok, *save, *q;
+    size_t n;
+
+    strcpy(buf, value);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+	tok += strspn(tok, " \t");
+	n = strcspn(tok, " \t;\r\n");
+	if ((n == 4 && !strncasecmp(tok, "gzip", 4)) ||
+	    (n == 6 && !strncasecmp(tok, "x-gzip", 6)))
+	    return !(q = strstr(tok, "q=")) || atof(q + 2) > 0;
+    }
+    return 0;
+}
+
 /*
  * parse_uri - parse URI into filename and CGI args
  *             return 0 if dynamic content, 1 if static
@@ -146,48 +439,337 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 /* $end parse_uri */
 
 /*
- * serve_static - copy a file back to the client 
+ * parse_range - resolve Range header value range against a file of
+ *     size bytes. Returns 1 with [*first, *last] set for one byte range,
+ *     -1 if it can't be satisfied, and 0 if the whole file should be
+ *     sent: no Range, several ranges, or one Tiny can't parse, all of
+ *     which a server may ignore.
+ */
+int parse_range(char *range, off_t size, off_t *first, off_t *last)
+{
+    long long a, b;
+    char *p, *end;
+
+    if (strncasecmp(range, "bytes=", 6) || strchr(range, ','))
+	return 0;
+    p = range + 6;
+    if (*p == '-') {                 /* The last b bytes */
+	if (!isdigit((unsigned char)p[1]))
+	    return 0;
+	b = strtoll(p + 1, &end, 10);
+	if (*end)
+	    return 0;
+	if (b == 0 || size == 0)
+	    return -1;
+	*first = b < size ? size - b : 0;
+	*last = size - 1;
+	return 1;
+    }
+    if (!isdigit((unsigned char)*p))
+	return 0;
+    a = strtoll(p, &end, 10);
+    if (*end != '-')
+	return 0;
+    p = end + 1;
+    b = size;                        /* "a-": to the end */
+    if (*p) {
+	if (!isdigit((unsigned char)*p))
+	    return 0;
+	b = strtoll(p, &end, 10);
+	if (*end || b < a)
+	    return 0;
+    }
+    if (a >= size)
+	return -1;
+    *first = a;
+    *last = b < size ? b : size - 1;
+    return 1;
+}
+
+/*
+ * is_handler - is filename a handler to load rather than a CGI program?
+ */
+int is_handler(char *filename)
+{
+    size_t n = strlen(filename);
+
+    return n > 3 && !strcmp(filename + n - 3, ".so");
+}
+
+/*
+ * gzip_variant - does filename have a readable precompressed sibling?
+ *     Its name goes in gzname (MAXLINE bytes) and its stat in sbuf.
+ */
+int gzip_variant(char *filename, char *gzname, struct stat *sbuf)
+{
+    return snprintf(gzname, MAXLINE, "%s.gz", filename) < MAXLINE &&
+	stat(gzname, sbuf) == 0 && S_ISREG(sbuf->st_mode) &&
+	(S_IRUSR & sbuf->st_mode);
+}
+
+/*
+ * serve_gzip - send filename's precompressed sibling, filename.gz, if
+ *     there is one. Returns 1 if it was sent, 0 if not.
+ */
+int serve_gzip(int fd, char *filename, sreq_t *sr)
+{
+    char gzname[MAXLINE];
+    struct stat sbuf;
+    fentry_t *fe;
+
+    if (snprintf(gzname, MAXLINE, "%s.gz", filename) >= MAXLINE)
+	return 0;
+    if ((fe = fcache_lookup(gzname)) != NULL)
+	serve_cached(fd, fe, sr, 1);
+    else if (gzip_variant(filename, gzname, &sbuf))
+	serve_static(fd, gzname, sbuf.st_size, sr, 1);
+    else
+	return 0;
+    return 1;
+}
+
+/*
+ * serve_static - copy a file back to the client. If gz, filename is
+ *     the gzip variant of the file asked for.
  */
 /* $begin serve_static */
-void serve_static(int fd, char *filename, int filesize)
+void serve_static(int fd, char *filename, off_t filesize, sreq_t *sr,
+		  int gz)
 {
-    int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    int srcfd, partial, hasgz;
+    size_t n;
+    off_t first = 0, last = filesize - 1;
+    char buf[MAXBUF], rbuf[MAXBUF], gzname[MAXLINE];
+    struct stat sbuf;
 
-    /* Send response headers to client */
-    get_filetype(filename, filetype);    //line:netp:servestatic:getfiletype
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); //line:netp:servestatic:beginserve
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n", filesize);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: %s\r\n\r\n", filetype);
-    Rio_writen(fd, buf, strlen(buf));    //line:netp:servestatic:endserve
+    PROBE3(static__start, fd, filename, filesize);
+    if ((partial = parse_range(sr->range, filesize, &first, &last)) < 0) {
+	range_error(fd, filesize);
+	return;
+    }
+
+    /* Send response headers to client, in one write. The cache keeps
+       those of a plain 200 for filename, whatever this response is */
+    hasgz = !gz && gzip_variant(filename, gzname, &sbuf);
+    n = static_headers(buf, filename, filesize, 0, hasgz, 0, 0, filesize - 1);
+    if (partial || gz)
+	Rio_writen(fd, rbuf, static_headers(rbuf, filename, filesize, gz,
+					    hasgz, partial, first, last));
+    else
+	Rio_writen(fd, buf, n);          //line:netp:servestatic:endserve
 
     /* Send response body to client */
     srcfd = Open(filename, O_RDONLY, 0); //line:netp:servestatic:open
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0); //line:netp:servestatic:mmap
-    Close(srcfd);                       //line:netp:servestatic:close
-    Rio_writen(fd, srcp, filesize);     //line:netp:servestatic:write
-    Munmap(srcp, filesize);             //line:netp:servestatic:munmap
+    if (!sr->head)
+	send_file(fd, srcfd, first, last - first + 1); //line:netp:servestatic:write
+
+    /* Keep it open, noting for gzip clients whether it has a variant */
+    if (fcache_insert(filename, srcfd, filesize, buf, n, hasgz) < 0)
+	Close(srcfd);                   //line:netp:servestatic:close
+    PROBE2(response__done, fd, partial ? 206 : 200);
 }
 
 /*
- * get_filetype - derive file type from file name
+ * cache_static - put filename, which has a gzip variant, in the
+ *     open-file cache without sending it, as serve_static would have
+ */
+void cache_static(char *filename, off_t filesize)
+{
+    char buf[MAXBUF];
+    size_t n = static_headers(buf, filename, filesize, 0, 1, 0, 0,
+			      filesize - 1);
+    int srcfd = open(filename, O_RDONLY);
+
+    if (srcfd >= 0 && fcache_insert(filename, srcfd, filesize, buf, n, 1) < 0)
+	Close(srcfd);
+}
+
+/*
+ * static_headers - format into buf the headers of a response carrying
+ *     bytes [first, last] of a filesize-byte file: a 206 if partial, a
+ *     200 for the whole file otherwise. If gz, filename is the gzip
+ *     variant of the file asked for, and is labeled as such. Caches
+ *     are told the response depends on Accept-Encoding if gz or vary,
+ *     which says the file has a variant. Returns their length.
+ */
+size_t static_headers(char *buf, const char *filename, off_t filesize,
+		      int gz, int vary, int partial, off_t first, off_t last)
+{
+    char filetype[MAXLINE], name[MAXLINE], crange[MAXLINE] = "";
+    size_t n;
+
+    /* The type is the original file's, without the .gz */
+    strcpy(name, filename);
+    if (gz)
+	name[strlen(name) - 3] = '\0';
+    get_filetype(name, filetype);        //line:netp:servestatic:getfiletype
+    if (partial)
+	snprintf(crange, MAXLINE, "Content-range: bytes %lld-%lld/%lld\r\n",
+		 (long long)first, (long long)last, (long long)filesize);
+    n = snprintf(buf, MAXBUF, "HTTP/1.0 %s\r\n" //line:netp:servestatic:beginserve
+		 "Server: Tiny Web Server\r\n"
+		 "Accept-ranges: bytes\r\n"
+		 "Content-length: %lld\r\n%s%s%s"
+		 "Content-type: %s\r\n\r\n",
+		 partial ? "206 Partial Content" : "200 OK",
+		 (long long)(last - first + 1), crange,
+		 gz ? "Content-encoding: gzip\r\n" : "",
+		 gz || vary ? "Vary: Accept-Encoding\r\n" : "",
+		 filetype);
+    return n < MAXBUF ? n : MAXBUF - 1;
+}
+
+/*
+ * bundle_headers - format the headers of a 200 for a bundled file
+ */
+size_t bundle_headers(char *buf, const char *path, off_t size, int gz,
+		      int vary)
+{
+    return static_headers(buf, path, size, gz, vary, 0, 0, size - 1);
+}
+
+/*
+ * range_error - tell the client its Range lies past the end of the file
+ */
+void range_error(int fd, off_t filesize)
+{
+    char buf[MAXLINE];
+    size_t n;
+
+    n = snprintf(buf, MAXLINE, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+		 "Server: Tiny Web Server\r\n"
+		 "Content-range: bytes */%lld\r\n"
+		 "Content-length: 0\r\n\r\n", (long long)filesize);
+    Rio_writen(fd, buf, n);
+    PROBE2(response__done, fd, 416);
+}
+
+/*
+ * serve_cached - send a file from the open-file cache, and release it.
+ *     If gz, it is the gzip variant of the file asked for.
+ */
+void serve_cached(int fd, fentry_t *fe, sreq_t *sr, int gz)
+{
+    int partial;
+    off_t first = 0, last = fe->size - 1;
+    char buf[MAXBUF];
+
+    PROBE3(static__start, fd, fe->path, fe->size);
+    if ((partial = parse_range(sr->range, fe->size, &first, &last)) < 0)
+	range_error(fd, fe->size);
+    else {
+	if (partial || gz)
+	    Rio_writen(fd, buf, static_headers(buf, fe->path, fe->size, gz,
+					       fe->gz, partial, first, last));
+	else
+	    Rio_writen(fd, fe->hdrs, fe->hdrlen);
+	if (!sr->head)
+	    send_file(fd, fe->fd, first, last - first + 1);
+	PROBE2(response__done, fd, partial ? 206 : 200);
+    }
+    fcache_release(fe);
+}
+
+/*
+ * serve_bundle - send a file from the bundle, or its gzip variant if
+ *     the client takes gzip and there is one
+ */
+void serve_bundle(int fd, bentry_t *be, sreq_t *sr)
+{
+    int partial, gz = sr->gzip && be->gz;
+    bentry_t *src = gz ? be->gz : be;
+    off_t first = 0, last = src->size - 1;
+    char buf[MAXBUF], *hdrs = gz ? be->gzhdrs : be->hdrs;
+    size_t hdrlen = gz ? be->gzhdrlen : be->hdrlen;
+
+    PROBE3(static__start, fd, src->path, src->size);
+    if ((partial = parse_range(sr->range, src->size, &first, &last)) < 0) {
+	range_error(fd, src->size);
+	return;
+    }
+    if (partial) {   /* Only whole-file headers are prebuilt */
+	hdrlen = static_headers(buf, src->path, src->size, gz, be->gz != NULL,
+				1, first, last);
+	hdrs = buf;
+    }
+    send_mem(fd, hdrs, hdrlen, src->data + first,
+	     sr->head ? 0 : last - first + 1);
+    PROBE2(response__done, fd, partial ? 206 : 200);
+}
+
+/*
+ * send_mem - write headers and a body in memory to fd with as few
+ *     system calls as possible: one, unless the socket fills. Returns
+ *     -1 if the client went away.
+ */
+int send_mem(int fd, const char *hdrs, size_t hdrlen, const char *body,
+	     size_t len)
+{
+    struct iovec iov[2];
+    int i = 0;
+    ssize_t n;
+
+    iov[0].iov_base = (void *)hdrs;
+    iov[0].iov_len = hdrlen;
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = len;
+    while (i < 2) {
+	if ((n = writev(fd, iov + i, 2 - i)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	for (; i < 2 && (size_t)n >= iov[i].iov_len; i++)
+	    n -= iov[i].iov_len;
+	if (i < 2) {
+	    iov[i].iov_base = (char *)iov[i].iov_base + n;
+	    iov[i].iov_len -= n;
+	}
+    }
+    return 0;
+}
+
+/*
+ * send_file - copy len bytes of file infd, from offset off, to outfd.
+ *     sendfile() moves the data inside the kernel, with no mapping to
+ *     set up and tear down and no copy through user space; mmap() and
+ *     write() are the fallback for files it can't send. Returns -1 if
+ *     the copy stopped short because the client went away or the file
+ *     shrank.
+ */
+int send_file(int outfd, int infd, off_t off, off_t len)
+{
+    off_t start = off, end = off + len;
+    ssize_t n;
+    char *srcp;
+
+    while (off < end) {   /* sendfile() may send less than asked */
+	if ((n = sendfile(outfd, infd, &off, end - off)) > 0)
+	    continue;
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && off == start && (errno == EINVAL || errno == ENOSYS))
+	    break;
+	return -1;
+    }
+    if (off == end)
+	return 0;
+
+    srcp = Mmap(0, end, PROT_READ, MAP_PRIVATE, infd, 0); //line:netp:servestatic:mmap
+    Rio_writen(outfd, srcp + start, len);
+    Munmap(srcp, end);                  //line:netp:servestatic:munmap
+    return 0;
+}
+
+/*
+ * get_filetype - derive file type from file name, by the media type
+ *     registry; unregistered extensions are served as text/plain
  */
 void get_filetype(char *filename, char *filetype) 
 {
-    if (strstr(filename, ".html"))
-	strcpy(filetype, "text/html");
-    else if (strstr(filename, ".gif"))
-	strcpy(filetype, "image/gif");
-    else if (strstr(filename, ".png"))
-	strcpy(filetype, "image/png");
-    else if (strstr(filename, ".jpg"))
-	strcpy(filetype, "image/jpeg");
-    else
-	strcpy(filetype, "text/plain");
+    const char *type = mime_type(filename);
+
+    strcpy(filetype, type ? type : "text/plain");
 }  
 /* $end serve_static */
 
@@ -195,26 +777,170 @@ void get_filetype(char *filename, char *filetype)
  * serve_dynamic - run a CGI program on behalf of the client
  */
 /* $begin serve_dynamic */
-void serve_dynamic(int fd, char *filename, char *cgiargs) 
+void serve_dynamic(int fd, char *filename, char *cgiargs, int http11) 
 {
     char buf[MAXLINE], *emptylist[] = { NULL };
+    char query[MAXLINE + 16], **envp;
+    pid_t pid;
+    int i, n, pfd[2];
 
-    /* Return first part of HTTP response */
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); 
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    PROBE3(dynamic__start, fd, filename, cgiargs);
+
+    /* Return first part of HTTP response. For an HTTP/1.1 client the
+       output comes back through a socketpair instead (see relay_cgi) */
+    if (!http11) {
+	sprintf(buf, "HTTP/1.0 200 OK\r\n"); 
+	Rio_writen(fd, buf, strlen(buf));
+	sprintf(buf, "Server: Tiny Web Server\r\n");
+	Rio_writen(fd, buf, strlen(buf));
+    }
+    else if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pfd) < 0)
+	unix_error("socketpair error");
   
-    if (Fork() == 0) { /* Child */ //line:netp:servedynamic:fork
-	/* Real server would set all CGI vars here */
-	setenv("QUERY_STRING", cgiargs, 1); //line:netp:servedynamic:setenv
-	Dup2(fd, STDOUT_FILENO);         /* Redirect stdout to client */ //line:netp:servedynamic:dup2
-	Execve(filename, emptylist, environ); /* Run CGI program */ //line:netp:servedynamic:execve
+    /* Real server would set all CGI vars here. Build the environment
+       before forking: a child of a threaded server can't call setenv() */
+    snprintf(query, sizeof(query), "QUERY_STRING=%s", cgiargs); //line:netp:servedynamic:setenv
+    for (n = 0; environ[n]; n++)
+	;
+    envp = Malloc((n + 2) * sizeof(char *));
+    for (i = n = 0; environ[i]; i++)
+	if (strncmp(environ[i], "QUERY_STRING=", 13))
+	    envp[n++] = environ[i];
+    envp[n++] = query;
+    envp[n] = NULL;
+
+    if ((pid = Fork()) == 0) { /* Child */ //line:netp:servedynamic:fork
+	Dup2(http11 ? pfd[1] : fd, STDOUT_FILENO); /* stdout to client or relay */ //line:netp:servedynamic:dup2
+	Signal(SIGPIPE, SIG_DFL);  /* Ignoring it would survive Execve */
+	Execve(filename, emptylist, envp); /* Run CGI program */ //line:netp:servedynamic:execve
+    }
+    if (http11) {
+	Close(pfd[1]);
+	if (relay_cgi(fd, pfd[0]) < 0)  /* Client left: stop the program, */
+	    kill(pid, SIGTERM);        /* which may ignore write errors */
+	Close(pfd[0]);
+    }
+    Waitpid(pid, NULL, 0); /* Parent waits for and reaps its child */ //line:netp:servedynamic:wait
+    Free(envp);
+    PROBE2(response__done, fd, 200);
+}
+
+/*
+ * relay_cgi - send the output of a CGI program, read from cgifd, to
+ *     an HTTP/1.1 client. Output whose headers give no Content-length
+ *     goes out in chunks as the program produces it, so the client sees
+ *     the first of it without waiting for the last; anything else is
+ *     passed on as it is, under HTTP/1.0. Returns -1 if the client went
+ *     away.
+ */
+int relay_cgi(int fd, int cgifd)
+{
+    char line[MAXLINE], hdrs[MAXBUF + MAXLINE], out[MAXBUF + 24];
+    char *data = out + 16;           /* Room for a chunk's size line */
+    size_t hdrlen = 0, k;
+    ssize_t n;
+    int chunked = 1, closes = 0, done = 0;
+    rio_t rio;
+
+    /* The program's headers, up to the blank line */
+    Rio_readinitb(&rio, cgifd);
+    while (!done && hdrlen < MAXBUF &&
+	   (n = rio_readlineb(&rio, line, MAXLINE)) > 0) {
+	memcpy(hdrs + hdrlen, line, n);
+	hdrlen += n;
+	if (!strncasecmp(line, "Content-length:", 15) ||
+	    !strncasecmp(line, "Transfer-encoding:", 18))
+	    chunked = 0;
+	if (!strncasecmp(line, "Connection:", 11))
+	    closes = 1;
+	done = !strcmp(line, "\r\n") || !strcmp(line, "\n");
     }
-    Wait(NULL); /* Parent waits for and reaps child */ //line:netp:servedynamic:wait
+    chunked = chunked && done;   /* No header block: pass it on as is */
+    n = snprintf(line, MAXLINE, "HTTP/1.%d 200 OK\r\n"
+		 "Server: Tiny Web Server\r\n%s%s", chunked,
+		 chunked ? "Transfer-encoding: chunked\r\n" : "",
+		 chunked && !closes ? "Connection: close\r\n" : "");
+    if (send_mem(fd, line, n, hdrs, hdrlen) < 0)
+	return -1;
+
+    /* The body: what rio already holds, then each read() as it comes.
+       A chunk's size line goes just before its data, in one write */
+    while ((n = rio.rio_cnt > 0 ? rio_readnb(&rio, data, rio.rio_cnt) :
+	    read(cgifd, data, MAXBUF)) != 0) {
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    break;
+	if (!chunked) {
+	    if (rio_writen(fd, data, n) < 0)
+		return -1;
+	    continue;
+	}
+	k = sprintf(line, "%zx\r\n", (size_t)n);
+	memcpy(data - k, line, k);
+	memcpy(data + n, "\r\n", 2);
+	if (rio_writen(fd, data - k, k + n + 2) < 0)
+	    return -1;
+    }
+    if (chunked && rio_writen(fd, "0\r\n\r\n", 5) < 0)
+	return -1;
+    return 0;
 }
 /* $end serve_dynamic */
 
+/* A handler's output, collected so a failure can still be reported */
+typedef struct {
+    char *buf;
+    size_t len, size;
+} hout_t;
+
+/* hout_write - The write callback handed to handlers */
+static void hout_write(void *ctx, const void *buf, size_t len)
+{
+    hout_t *out = ctx;
+
+    if (out->len + len > out->size) {
+	while (out->len + len > out->size)
+	    out->size *= 2;
+	out->buf = Realloc(out->buf, out->size);
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+}
+
+/*
+ * serve_handler - answer a dynamic request by calling a loaded handler
+ */
+void serve_handler(int fd, char *filename, char *cgiargs, struct stat *sbuf)
+{
+    static char status[] = "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n";
+    hmod_t *hm;
+    hout_t out;
+    int rc;
+
+    PROBE3(dynamic__start, fd, filename, cgiargs);
+    if (!(hm = handler_get(filename, sbuf))) {
+	clienterror(fd, filename, "500", "Internal Server Error",
+		    "Tiny couldn't load the handler");
+	PROBE2(response__done, fd, 500);
+	return;
+    }
+    out.size = MAXBUF;
+    out.buf = Malloc(out.size);
+    out.len = 0;
+    hout_write(&out, status, sizeof(status) - 1);
+    rc = hm->fn(cgiargs, hout_write, &out);
+    handler_put(hm);
+
+    if (rc == 0)
+	Rio_writen(fd, out.buf, out.len);
+    else
+	clienterror(fd, filename, "500", "Internal Server Error",
+		    "The handler failed");
+    Free(out.buf);
+    PROBE2(response__done, fd, rc == 0 ? 200 : 500);
+}
+
 /*
  * clienterror - returns an error message to the client
  */
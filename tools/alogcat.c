@@ -0,0 +1,71 @@
+/*
+ * alogcat - Print binary access logs written by proxy -l as text
+ *
+ * usage: alogcat [file ...]
+ *
+ * Reads each file (or stdin) and prints one line per request:
+ *
+ *   time client status HIT|MISS bytes total_us ttfb_us url
+ */
+#include "csapp.h"
+#include "alog.h"
+
+/* print_rec - Print one record as a line of text */
+static void print_rec(const alog_rec_t *rec)
+{
+    char when[64], addr[INET6_ADDRSTRLEN];
+    time_t secs = rec->time_us / 1000000;
+    struct tm tm;
+
+    gmtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!inet_ntop(rec->family, rec->addr, addr, sizeof(addr)))
+	strcpy(addr, "?");
+    printf("%s.%06uZ %s%s%s:%u %u %s %lu %u %u %.*s%s\n", when,
+	   (unsigned)(rec->time_us % 1000000),
+	   rec->family == AF_INET6 ? "[" : "", addr,
+	   rec->family == AF_INET6 ? "]" : "", rec->port, rec->status,
+	   rec->flags & ALOG_HIT ? "HIT" : "MISS", (unsigned long)rec->bytes,
+	   rec->total_us, rec->ttfb_us, ALOG_URLLEN, rec->url,
+	   rec->flags & ALOG_TRUNC ? "..." : "");
+}
+
+/* cat_fd - Decode the log open on fd. Returns -1 if it isn't one */
+static int cat_fd(int fd, const char *name)
+{
+    char magic[ALOG_MAGICLEN];
+    alog_rec_t rec;
+    ssize_t n;
+
+    if (rio_readn(fd, magic, ALOG_MAGICLEN) != ALOG_MAGICLEN ||
+	memcmp(magic, ALOG_MAGIC, ALOG_MAGICLEN)) {
+	fprintf(stderr, "alogcat: %s: not an access log\n", name);
+	return -1;
+    }
+    while ((n = rio_readn(fd, &rec, sizeof(rec))) == sizeof(rec))
+	print_rec(&rec);
+    if (n != 0) {
+	fprintf(stderr, "alogcat: %s: truncated record\n", name);
+	return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i, fd, rc = 0;
+
+    if (argc < 2)
+	return cat_fd(STDIN_FILENO, "stdin") < 0;
+    for (i = 1; i < argc; i++) {
+	if ((fd = open(argv[i], O_RDONLY)) < 0) {
+	    fprintf(stderr, "alogcat: %s: %s\n", argv[i], strerror(errno));
+	    rc = 1;
+	    continue;
+	}
+	if (cat_fd(fd, argv[i]) < 0)
+	    rc = 1;
+	close(fd);
+    }
+    return rc;
+}
@@ -0,0 +1,208 @@
+/*
+ * cachesim - Replay a request trace through the proxy's cache
+ *
+ * usage: cachesim [-p policy|all] [-s size[,size...]] [-m maxobj]
+ *                 [-n shards] [trace]
+ *
+ * The trace (default stdin) is either a binary access log written by
+ * "proxy -l", whose 200 responses are replayed, or text lines of
+ *
+ *     timestamp url size
+ *
+ * Each request is looked up in a cache built by cache.c, exactly as
+ * the proxy does; a miss inserts the object, which the cache refuses
+ * if it is larger than maxobj. The whole trace is replayed for every
+ * policy and cache size, and one line is printed per run:
+ *
+ *     policy size requests hit_ratio byte_hit_ratio evictions churn
+ *
+ * churn is evicted bytes per requested byte. Sizes take K, M and G
+ * suffixes; the default sweep is 128K to 64M in powers of two.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "alog.h"
+
+#define MAX_OBJECT_SIZE 102400  /* As in proxy.c */
+#define CACHE_NSHARDS   8
+#define MAXSIZES        64
+
+typedef struct {
+    char *url;
+    size_t size;
+} treq_t;
+
+static treq_t *trace;
+static size_t ntrace, tracecap;
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-p policy|all] [-s size[,size...]] "
+	    "[-m maxobj] [-n shards] [trace]\n", prog);
+    exit(1);
+}
+
+/* parse_size - Parse a byte count with an optional K, M or G suffix */
+static size_t parse_size(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    switch (toupper((unsigned char)*end)) {
+    case 'G': v *= 1024;  /* fall through */
+    case 'M': v *= 1024;  /* fall through */
+    case 'K': v *= 1024;
+    }
+    return v;
+}
+
+static void add_req(const char *url, size_t size)
+{
+    if (ntrace == tracecap) {
+	tracecap = tracecap ? 2 * tracecap : 4096;
+	trace = Realloc(trace, tracecap * sizeof(treq_t));
+    }
+    trace[ntrace].url = strdup(url);
+    trace[ntrace].size = size;
+    ntrace++;
+}
+
+/* load_alog - Read the 200 responses of a binary access log on fp */
+static void load_alog(FILE *fp)
+{
+    alog_rec_t rec;
+
+    while (fread(&rec, sizeof(rec), 1, fp) == 1)
+	if (rec.status == 200 && !(rec.flags & ALOG_TRUNC))
+	    add_req(rec.url, rec.bytes);
+}
+
+/* text_req - Add the request of one "timestamp url size" line */
+static void text_req(const char *line)
+{
+    char ts[MAXLINE], url[MAXLINE];
+    unsigned long size;
+
+    if (sscanf(line, "%s %s %lu", ts, url, &size) == 3)
+	add_req(url, size);
+}
+
+/*
+ * load_text - Read "timestamp url size" lines: those in first, the
+ *     bytes already read to sniff the format, then the rest on fp
+ */
+static void load_text(FILE *fp, char *first)
+{
+    char line[MAXLINE], *nl;
+    size_t len;
+
+    while ((nl = strchr(first, '\n')) != NULL) {
+	*nl = '\0';
+	text_req(first);
+	first = nl + 1;
+    }
+    len = strlen(first);             /* The start of the next line */
+    strcpy(line, first);
+    if (!fgets(line + len, MAXLINE - len, fp) && len == 0)
+	return;
+    do {
+	text_req(line);
+    } while (fgets(line, MAXLINE, fp));
+}
+
+static void load_trace(FILE *fp)
+{
+    char first[ALOG_MAGICLEN + 1];
+    size_t n = fread(first, 1, ALOG_MAGICLEN, fp);
+
+    if (n == ALOG_MAGICLEN && !memcmp(first, ALOG_MAGIC, ALOG_MAGICLEN)) {
+	load_alog(fp);
+	return;
+    }
+    first[n] = '\0';
+    load_text(fp, first);
+}
+
+/* run - Replay the trace through one cache configuration */
+static void run(const char *policy, size_t size, size_t maxobj, int nshards,
+		char *data)
+{
+    cache_t cache;
+    cache_stats_t st;
+    cache_obj_t *obj;
+    unsigned long reqbytes = 0, hitbytes = 0;
+    size_t i;
+
+    cache_init(&cache, size, maxobj, nshards);
+    cache_setpolicy(&cache, policy);
+    for (i = 0; i < ntrace; i++) {
+	reqbytes += trace[i].size;
+	if ((obj = cache_lookup(&cache, trace[i].url)) != NULL) {
+	    hitbytes += trace[i].size;
+	    cache_release(&cache, obj);
+	}
+	else
+	    cache_insert(&cache, trace[i].url, data, trace[i].size);
+    }
+    cache_stats(&cache, &st);
+    printf("%-6s %10zu %9zu %9.4f %14.4f %9lu %9.4f\n", policy, size, ntrace,
+	   ntrace ? (double)st.hits / ntrace : 0,
+	   reqbytes ? (double)hitbytes / reqbytes : 0, st.evictions,
+	   reqbytes ? (double)st.evictbytes / reqbytes : 0);
+    cache_deinit(&cache);
+}
+
+int main(int argc, char **argv)
+{
+    size_t sizes[MAXSIZES], maxobj = MAX_OBJECT_SIZE;
+    int nsizes = 0, nshards = CACHE_NSHARDS, c, i, j;
+    char *policy = "all", *tok, *data;
+    FILE *fp = stdin;
+
+    while ((c = getopt(argc, argv, "p:s:m:n:")) != -1) {
+	switch (c) {
+	case 'p':
+	    policy = optarg;
+	    break;
+	case 's':
+	    for (tok = strtok(optarg, ","); tok && nsizes < MAXSIZES;
+		 tok = strtok(NULL, ","))
+		sizes[nsizes++] = parse_size(tok);
+	    break;
+	case 'm':
+	    maxobj = parse_size(optarg);
+	    break;
+	case 'n':
+	    nshards = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind < argc - 1 || nshards < 1)
+	usage(argv[0]);
+    for (i = 0; cache_policies[i]; i++)
+	if (!strcmp(policy, cache_policies[i]->name))
+	    break;
+    if (!cache_policies[i] && strcmp(policy, "all")) {
+	fprintf(stderr, "cachesim: no policy %s\n", policy);
+	exit(1);
+    }
+    if (optind == argc - 1 && !(fp = fopen(argv[optind], "r")))
+	unix_error("can't open trace");
+    if (nsizes == 0)
+	for (nsizes = 0; nsizes < 10; nsizes++)
+	    sizes[nsizes] = (size_t)128 * 1024 << nsizes;
+
+    load_trace(fp);
+    data = Calloc(1, maxobj);
+    printf("%-6s %10s %9s %9s %14s %9s %9s\n", "policy", "size", "requests",
+	   "hit_ratio", "byte_hit_ratio", "evictions", "churn");
+    for (i = 0; cache_policies[i]; i++) {
+	if (strcmp(policy, "all") && strcmp(policy, cache_policies[i]->name))
+	    continue;
+	for (j = 0; j < nsizes; j++)
+	    run(cache_policies[i]->name, sizes[j], maxobj, nshards, data);
+    }
+    return 0;
+}
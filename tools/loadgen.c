@@ -0,0 +1,581 @@
+/*
+ * loadgen - Multi-threaded, epoll-based HTTP load generator
+ *
+ * usage: loadgen [-c conns] [-t threads] [-d seconds] [-r rate] [-k]
+ *                [-x proxyhost:port] [-f urlfile] [url ...]
+ *
+ * Each thread drives its share of the connections from one epoll
+ * loop. Without -r the test is closed-loop: a connection sends its
+ * next request as soon as the last response is complete. With -r the
+ * test is open-loop: requests are due at a constant total rate, and
+ * latency is measured from when a request was due, not from when a
+ * free connection got around to sending it, so a stalled server is
+ * charged for the requests it held back (coordinated omission).
+ *
+ * URLs come from the command line and/or a file of "url" or
+ * "weight url" lines, and are picked at random by weight. With -x the
+ * requests go to a proxy in absolute form, otherwise straight to each
+ * URL's server. -k uses HTTP/1.1 keep-alive when the server allows it:
+ * responses framed by Content-length or chunked transfer coding keep
+ * the connection; any other response ends at EOF.
+ *
+ * Results are printed on stdout as JSON.
+ */
+#include "csapp.h"
+#include <sys/epoll.h>
+#include <limits.h>
+#include "http.h"
+#include "stats.h"
+
+#define MAXTARGETS 1024
+#define MAXEVENTS  64
+#define CHUNK      65536
+
+/* A URL in the mix */
+typedef struct {
+    char *url;
+    double weight;                   /* Cumulative, for picking */
+    char *request;                   /* Ready to send */
+    size_t reqlen;
+    struct sockaddr_storage addr;    /* Where to connect */
+    socklen_t addrlen;
+} target_t;
+
+/* Connection states */
+enum { LC_IDLE, LC_CONNECTING, LC_SENDING, LC_RECEIVING };
+
+/* Where a chunked body is: size line, data, CRLF after it, trailer */
+enum { CH_SIZE, CH_DATA, CH_DATAEND, CH_TRAILER };
+
+typedef struct {
+    int fd;                          /* -1 when not connected */
+    int state;                       /* LC_* */
+    target_t *tgt;                   /* Request in flight */
+    size_t sent;                     /* Request bytes sent */
+    char hdr[MAXBUF];                /* Response headers */
+    size_t hdrlen;
+    int hdrdone, status, keepalive;
+    long clen;                       /* Content-length, -1 if none */
+    int chunked;                     /* Transfer-Encoding: chunked */
+    int cstate;                      /* CH_*, for a chunked body */
+    long cleft;                      /* Bytes left in chunk, or size so far */
+    int pastsize;                    /* Size line: past the hex digits */
+    size_t linelen;                  /* Bytes in the trailer line so far */
+    size_t bodylen;                  /* Body bytes received */
+    unsigned long start;             /* When the request was due */
+} lconn_t;
+
+typedef struct {
+    pthread_t tid;
+    lconn_t *conns;
+    int nconns;
+    int ep;                          /* epoll instance */
+    unsigned int seed;
+    double interval;                 /* Open loop: us between requests */
+    unsigned long t0, k;             /* Request k is due at t0 + k*interval */
+    hist_t hist;                     /* Latency, us */
+    unsigned long requests, errors, bytes, backlog;
+    unsigned long status[6];         /* 1xx..5xx, other */
+} worker_t;
+
+static target_t targets[MAXTARGETS];
+static int ntargets;
+static double totalweight;
+static int keepalive;
+static char *proxy;                  /* host:port, or NULL */
+static unsigned long endtime;        /* stats_now() when the test ends */
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-c conns] [-t threads] [-d seconds] "
+	    "[-r rate] [-k]\n"
+	    "       [-x proxyhost:port] [-f urlfile] [url ...]\n", prog);
+    exit(1);
+}
+
+/* resolve - Look up host:port into target t's address */
+static int resolve(target_t *t, char *host, char *port)
+{
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+	return -1;
+    memcpy(&t->addr, res->ai_addr, res->ai_addrlen);
+    t->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/* add_target - Add url to the mix with the given weight */
+static void add_target(char *url, double weight)
+{
+    char host[MAXLINE], port[MAXLINE], path[MAXLINE], buf[MAXBUF];
+    char phost[MAXLINE], *colon;
+    target_t *t = &targets[ntargets];
+    int n;
+
+    if (ntargets == MAXTARGETS)
+	app_error("too many URLs");
+    if (parse_uri(url, host, port, path) < 0) {
+	fprintf(stderr, "loadgen: bad URL %s\n", url);
+	exit(1);
+    }
+    n = snprintf(buf, MAXBUF, "GET %s %s\r\nHost: %s%s%s%s%s\r\n"
+		 "Connection: %s\r\n\r\n", proxy ? url : path,
+		 keepalive ? "HTTP/1.1" : "HTTP/1.0",
+		 strchr(host, ':') ? "[" : "", host,
+		 strchr(host, ':') ? "]" : "",
+		 strcmp(port, HTTP_DEFPORT) ? ":" : "",
+		 strcmp(port, HTTP_DEFPORT) ? port : "",
+		 keepalive ? "keep-alive" : "close");
+    t->url = strdup(url);
+    t->request = strdup(buf);
+    t->reqlen = n;
+    totalweight += weight;
+    t->weight = totalweight;
+
+    if (proxy) {
+	strcpy(phost, proxy);
+	if (!(colon = strrchr(phost, ':')))
+	    app_error("proxy must be host:port");
+	*colon = '\0';
+	n = resolve(t, phost, colon + 1);
+    }
+    else
+	n = resolve(t, host, port);
+    if (n < 0) {
+	fprintf(stderr, "loadgen: can't resolve %s\n", proxy ? proxy : host);
+	exit(1);
+    }
+    ntargets++;
+}
+
+/* read_urls - Add the "[weight] url" lines of file to the mix */
+static void read_urls(char *file)
+{
+    FILE *fp;
+    char line[MAXLINE], a[MAXLINE], b[MAXLINE];
+    int n;
+
+    if (!(fp = fopen(file, "r")))
+	unix_error("can't open URL file");
+    while (fgets(line, MAXLINE, fp)) {
+	if ((n = sscanf(line, "%s %s", a, b)) < 1 || a[0] == '#')
+	    continue;
+	if (n == 2)
+	    add_target(b, atof(a));
+	else
+	    add_target(a, 1.0);
+    }
+    fclose(fp);
+}
+
+/* pick - Choose a target at random by weight */
+static target_t *pick(worker_t *w)
+{
+    double x = totalweight * rand_r(&w->seed) / ((double)RAND_MAX + 1);
+    int lo = 0, hi = ntargets - 1, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (targets[mid].weight > x)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+    return &targets[lo];
+}
+
+/* watch - Wait for events on c's socket */
+static void watch(worker_t *w, lconn_t *c, int op, unsigned int events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(w->ep, op, c->fd, &ev);
+}
+
+static void disconnect(lconn_t *c)
+{
+    if (c->fd >= 0)
+	close(c->fd);
+    c->fd = -1;
+    c->state = LC_IDLE;
+}
+
+/* finish - Account for the request on c, ok or not, and free c */
+static void finish(worker_t *w, lconn_t *c, int ok)
+{
+    if (ok) {
+	hist_record(&w->hist, stats_now() - c->start);
+	w->requests++;
+	w->status[c->status >= 100 && c->status < 600 ? c->status / 100 - 1
+		  : 5]++;
+    }
+    else
+	w->errors++;
+    if (ok && c->keepalive)
+	c->state = LC_IDLE;
+    else
+	disconnect(c);
+}
+
+/* send_request - Send as much of the request as the socket takes */
+static void send_request(worker_t *w, lconn_t *c)
+{
+    ssize_t n;
+
+    while (c->sent < c->tgt->reqlen) {
+	n = send(c->fd, c->tgt->request + c->sent, c->tgt->reqlen - c->sent,
+		 MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		watch(w, c, EPOLL_CTL_MOD, EPOLLOUT);
+		return;
+	    }
+	    finish(w, c, 0);
+	    return;
+	}
+	c->sent += n;
+    }
+    c->state = LC_RECEIVING;
+    watch(w, c, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+/* start - Begin a request on idle connection c, due at time due */
+static void start(worker_t *w, lconn_t *c, unsigned long due)
+{
+    c->tgt = pick(w);
+    c->start = due;
+    c->sent = c->hdrlen = c->bodylen = 0;
+    c->hdrdone = 0;
+    c->status = 0;
+    c->clen = -1;
+    c->chunked = 0;
+
+    if (c->fd >= 0) {
+	c->state = LC_SENDING;
+	send_request(w, c);
+	return;
+    }
+    c->fd = socket(c->tgt->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) {
+	finish(w, c, 0);
+	return;
+    }
+    if (connect(c->fd, (SA *)&c->tgt->addr, c->tgt->addrlen) < 0 &&
+	errno != EINPROGRESS) {
+	finish(w, c, 0);
+	return;
+    }
+    c->state = LC_CONNECTING;
+    watch(w, c, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+/* header_value - Find header name in hdrs and return its value, or NULL */
+static char *header_value(char *hdrs, const char *name)
+{
+    char *line = strstr(hdrs, "\r\n");
+    size_t len = strlen(name);
+
+    while (line && line[2] != '\r') {
+	line += 2;
+	if (!strncasecmp(line, name, len) && line[len] == ':') {
+	    line += len + 1;
+	    while (*line == ' ' || *line == '\t')
+		line++;
+	    return line;
+	}
+	line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+/* parse_headers - Note status, length and reusability of the response */
+static void parse_headers(lconn_t *c)
+{
+    char *v;
+
+    c->status = parse_status(c->hdr, c->hdrlen);
+    if ((v = header_value(c->hdr, "Transfer-Encoding")) != NULL &&
+	!strncasecmp(v, "chunked", 7)) {
+	c->chunked = 1;              /* Overrides any Content-Length */
+	c->cstate = CH_SIZE;
+	c->cleft = 0;
+	c->pastsize = 0;
+    }
+    else if ((v = header_value(c->hdr, "Content-Length")) != NULL)
+	c->clen = strtol(v, NULL, 10);
+    c->keepalive = keepalive && (c->clen >= 0 || c->chunked);
+    if ((v = header_value(c->hdr, "Connection")) != NULL) {
+	if (!strncasecmp(v, "close", 5))
+	    c->keepalive = 0;
+	else if (!strncasecmp(v, "keep-alive", 10))
+	    c->keepalive = keepalive && (c->clen >= 0 || c->chunked);
+    }
+    else if (strncmp(c->hdr, "HTTP/1.1", 8))  /* 1.0 closes by default */
+	c->keepalive = 0;
+}
+
+/*
+ * chunk_scan - Follow n bytes of chunked body p on c. Returns 1 once
+ *     the last chunk and trailer are in, -1 if the framing is bad, or 0
+ */
+static int chunk_scan(lconn_t *c, const char *p, size_t n)
+{
+    const char *end = p + n;
+    size_t take;
+    int d;
+
+    while (p < end) {
+	switch (c->cstate) {
+	case CH_SIZE:                /* Hex size, any extensions, CRLF */
+	    if (*p == '\n') {
+		c->cstate = c->cleft > 0 ? CH_DATA : CH_TRAILER;
+		c->linelen = 0;
+	    }
+	    else if (!c->pastsize && isxdigit((unsigned char)*p)) {
+		d = isdigit((unsigned char)*p) ? *p - '0'
+		    : tolower((unsigned char)*p) - 'a' + 10;
+		if (c->cleft > (LONG_MAX - d) / 16)
+		    return -1;
+		c->cleft = c->cleft * 16 + d;
+	    }
+	    else
+		c->pastsize = 1;     /* ";ext" or the CR */
+	    p++;
+	    break;
+	case CH_DATA:
+	    take = end - p < c->cleft ? end - p : c->cleft;
+	    p += take;
+	    if ((c->cleft -= take) == 0)
+		c->cstate = CH_DATAEND;
+	    break;
+	case CH_DATAEND:             /* The CRLF closing the data */
+	    if (*p++ == '\n') {
+		c->cstate = CH_SIZE;
+		c->pastsize = 0;
+	    }
+	    break;
+	case CH_TRAILER:             /* Header lines up to an empty one */
+	    if (*p++ != '\n')
+		c->linelen += p[-1] != '\r';
+	    else if (c->linelen == 0)
+		return 1;
+	    else
+		c->linelen = 0;
+	    break;
+	}
+    }
+    return 0;
+}
+
+/* receive - Read response bytes from c, finishing it when complete */
+static void receive(worker_t *w, lconn_t *c, char *buf)
+{
+    ssize_t n;
+    size_t take, off;
+    char *end, *body;
+    int rc;
+
+    while ((n = read(c->fd, buf, CHUNK)) > 0) {
+	w->bytes += n;
+	body = buf;
+	if (c->hdrdone) {
+	    c->bodylen += n;
+	}
+	else {
+	    take = n < sizeof(c->hdr) - 1 - c->hdrlen ? n
+		   : sizeof(c->hdr) - 1 - c->hdrlen;
+	    memcpy(c->hdr + c->hdrlen, buf, take);
+	    c->hdrlen += take;
+	    c->hdr[c->hdrlen] = '\0';
+	    if ((end = strstr(c->hdr, "\r\n\r\n")) != NULL) {
+		c->hdrdone = 1;
+		parse_headers(c);
+		off = end + 4 - c->hdr - (c->hdrlen - take);
+		c->bodylen = n - off;
+		body = buf + off;
+	    }
+	    else if (c->hdrlen == sizeof(c->hdr) - 1) {
+		finish(w, c, 0);    /* Headers too long */
+		return;
+	    }
+	}
+	if (c->hdrdone && c->chunked &&
+	    (rc = chunk_scan(c, body, n - (body - buf))) != 0) {
+	    finish(w, c, rc > 0);
+	    return;
+	}
+	if (c->hdrdone && c->clen >= 0 && c->bodylen >= c->clen) {
+	    finish(w, c, 1);
+	    return;
+	}
+    }
+    if (n == 0)   /* EOF ends a response without a length */
+	finish(w, c, c->hdrdone && c->clen < 0 && !c->chunked);
+    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+	finish(w, c, 0);
+}
+
+/* issue - Start requests on idle connections as the schedule allows */
+static void issue(worker_t *w, unsigned long now)
+{
+    unsigned long due;
+    int i;
+
+    for (i = 0; i < w->nconns; i++) {
+	if (w->conns[i].state != LC_IDLE)
+	    continue;
+	if (w->interval == 0)
+	    start(w, &w->conns[i], now);
+	else {
+	    due = w->t0 + (unsigned long)(w->k * w->interval);
+	    if (due > now)
+		break;
+	    w->k++;
+	    start(w, &w->conns[i], due);
+	}
+    }
+}
+
+/* worker - Thread routine: run this worker's connections until endtime */
+static void *worker(void *vargp)
+{
+    worker_t *w = vargp;
+    struct epoll_event evs[MAXEVENTS];
+    char *buf = Malloc(CHUNK);
+    lconn_t *c;
+    unsigned long now, due;
+    int i, n, err, timeout;
+    socklen_t len;
+
+    w->ep = epoll_create1(0);
+    w->t0 = stats_now();
+    while ((now = stats_now()) < endtime) {
+	issue(w, now);
+	timeout = 100;
+	if (w->interval) {
+	    due = w->t0 + (unsigned long)(w->k * w->interval);
+	    timeout = due > now ? (due - now) / 1000 : 0;
+	}
+	if ((now = stats_now()) + timeout * 1000UL > endtime)
+	    timeout = endtime > now ? (endtime - now) / 1000 : 0;
+	n = epoll_wait(w->ep, evs, MAXEVENTS, timeout);
+	for (i = 0; i < n; i++) {
+	    c = evs[i].data.ptr;
+	    if (c->state == LC_IDLE) {   /* Server closed a kept-alive conn */
+		disconnect(c);
+		continue;
+	    }
+	    if (c->state == LC_CONNECTING) {
+		len = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err) {
+		    finish(w, c, 0);
+		    continue;
+		}
+		c->state = LC_SENDING;
+	    }
+	    if (c->state == LC_SENDING)
+		send_request(w, c);
+	    else if (c->state == LC_RECEIVING)
+		receive(w, c, buf);
+	}
+    }
+
+    /* Requests that fell due but never went out */
+    if (w->interval)
+	w->backlog = (endtime - w->t0) / w->interval - w->k;
+    for (i = 0; i < w->nconns; i++)
+	disconnect(&w->conns[i]);
+    close(w->ep);
+    Free(buf);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nconns = 10, nthreads = 1;
+    double secs = 10, rate = 0, elapsed;
+    char *urlfile = NULL;
+    worker_t *ws;
+    hist_t *all = Calloc(1, sizeof(hist_t));
+    unsigned long requests = 0, errors = 0, bytes = 0, backlog = 0;
+    unsigned long status[6] = { 0 }, begin;
+    static const char *classes[6] = { "1xx", "2xx", "3xx", "4xx", "5xx",
+				      "other" };
+
+    while ((c = getopt(argc, argv, "c:t:d:r:kx:f:")) != -1) {
+	switch (c) {
+	case 'c': nconns = atoi(optarg); break;
+	case 't': nthreads = atoi(optarg); break;
+	case 'd': secs = atof(optarg); break;
+	case 'r': rate = atof(optarg); break;
+	case 'k': keepalive = 1; break;
+	case 'x': proxy = optarg; break;
+	case 'f': urlfile = optarg; break;
+	default: usage(argv[0]);
+	}
+    }
+    if (urlfile)
+	read_urls(urlfile);
+    for (i = optind; i < argc; i++)
+	add_target(argv[i], 1.0);
+    if (ntargets == 0 || nconns < 1 || nthreads < 1 || secs <= 0)
+	usage(argv[0]);
+    if (nthreads > nconns)
+	nthreads = nconns;
+    signal(SIGPIPE, SIG_IGN);
+
+    ws = Calloc(nthreads, sizeof(worker_t));
+    begin = stats_now();
+    endtime = begin + (unsigned long)(secs * 1000000);
+    for (i = 0; i < nthreads; i++) {
+	ws[i].nconns = nconns / nthreads + (i < nconns % nthreads);
+	ws[i].conns = Calloc(ws[i].nconns, sizeof(lconn_t));
+	for (c = 0; c < ws[i].nconns; c++)
+	    ws[i].conns[c].fd = -1;
+	ws[i].seed = begin + i;
+	ws[i].interval = rate > 0 ? 1e6 * nthreads / rate : 0;
+	Pthread_create(&ws[i].tid, NULL, worker, &ws[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+	Pthread_join(ws[i].tid, NULL);
+	requests += ws[i].requests;
+	errors += ws[i].errors;
+	bytes += ws[i].bytes;
+	backlog += ws[i].backlog;
+	for (c = 0; c < 6; c++)
+	    status[c] += ws[i].status[c];
+	for (c = 0; c < HIST_NBUCKETS; c++)
+	    all->counts[c] += ws[i].hist.counts[c];
+	all->total += ws[i].hist.total;
+	all->sum += ws[i].hist.sum;
+	if (ws[i].hist.max > all->max)
+	    all->max = ws[i].hist.max;
+    }
+    elapsed = (stats_now() - begin) / 1e6;
+
+    printf("{\n  \"mode\": \"%s\", \"rate\": %.1f, \"connections\": %d, "
+	   "\"threads\": %d, \"keepalive\": %s,\n", rate > 0 ? "open" : "closed",
+	   rate, nconns, nthreads, keepalive ? "true" : "false");
+    printf("  \"duration_s\": %.3f, \"requests\": %lu, \"errors\": %lu, "
+	   "\"backlog\": %lu, \"bytes\": %lu,\n", elapsed, requests, errors,
+	   backlog, bytes);
+    printf("  \"rps\": %.1f, \"mbps\": %.2f,\n", requests / elapsed,
+	   bytes * 8 / elapsed / 1e6);
+    printf("  \"status\": {");
+    for (c = 0; c < 6; c++)
+	printf("%s\"%s\": %lu", c ? ", " : "", classes[c], status[c]);
+    printf("},\n  \"latency_us\": {\"mean\": %lu, \"p50\": %lu, "
+	   "\"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}\n}\n",
+	   all->total ? all->sum / all->total : 0,
+	   hist_percentile(all, 0.5), hist_percentile(all, 0.9),
+	   hist_percentile(all, 0.99), hist_percentile(all, 0.999), all->max);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * origin - Synthetic origin server for testing the proxy
+ *
+ * usage: origin [-s size] [-d delay-ms] [-D fixed|uniform|exp|pareto]
+ *               [-b bytes/s] [-k] [-r reset-after] [-c cache-control]
+ *               [-e etag] <port>
+ *
+ * Every GET is answered with a generated body, shaped by the command
+ * line defaults, each of which a request can override with a query
+ * parameter of the same meaning:
+ *
+ *   size=N      body bytes (-s, default 1024)
+ *   delay=MS    mean time to first byte (-d, default 0)
+ *   dist=D      delay distribution (-D): fixed, uniform on [0, 2*MS],
+ *               exponential, or Pareto (alpha 1.5) with mean MS
+ *   bw=N        throttle the body to N bytes/s (-b, default unlimited)
+ *   chunked=1   Transfer-Encoding: chunked instead of Content-length (-k)
+ *   reset=N     reset the connection after N body bytes (-r)
+ *   cc=V        Cache-Control: V (-c)
+ *   etag=V      ETag: "V" (-e), and 304 for a matching If-None-Match
+ *   status=N    response status (default 200)
+ *
+ * e.g. GET /x?size=1000000&bw=100000&cc=max-age%3D60. The body is a
+ * repeating pattern of the letters a-z, so relayed copies can be
+ * checked. Each connection gets its own thread; HTTP/1.1 clients may
+ * send further requests on it.
+ */
+#include "csapp.h"
+#include <math.h>
+#include <netinet/tcp.h>
+#include "http.h"
+
+#define SENDCHUNK 8192                /* Body bytes per send() */
+
+enum { D_FIXED, D_UNIFORM, D_EXP, D_PARETO };
+
+/* How to answer one request */
+typedef struct {
+    long size;
+    long delay;                       /* ms */
+    int dist;                         /* D_* */
+    long bw;                          /* bytes/s, 0 for unlimited */
+    int chunked;
+    long reset;                       /* -1 for never */
+    char cc[MAXLINE];
+    char etag[MAXLINE];
+    int status;
+} shape_t;
+
+static shape_t defaults = { 1024, 0, D_FIXED, 0, 0, -1, "", "", 200 };
+static const char *dist_names[] = { "fixed", "uniform", "exp", "pareto" };
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-s size] [-d delay-ms] "
+	    "[-D fixed|uniform|exp|pareto]\n"
+	    "       [-b bytes/s] [-k] [-r reset-after] [-c cache-control] "
+	    "[-e etag] <port>\n", prog);
+    exit(1);
+}
+
+static int parse_dist(const char *s)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+	if (!strcmp(s, dist_names[i]))
+	    return i;
+    return -1;
+}
+
+/* urldecode - Decode %XX escapes and '+' in s, in place */
+static void urldecode(char *s)
+{
+    char *d = s;
+    unsigned int c;
+
+    for (; *s; s++) {
+	if (*s == '%' && isxdigit((unsigned char)s[1]) &&
+	    isxdigit((unsigned char)s[2]) && sscanf(s + 1, "%2x", &c) == 1) {
+	    *d++ = c;
+	    s += 2;
+	}
+	else
+	    *d++ = *s == '+' ? ' ' : *s;
+    }
+    *d = '\0';
+}
+
+/* parse_query - Apply the key=value parameters of uri's query to sp */
+static void parse_query(char *uri, shape_t *sp)
+{
+    char *q = strchr(uri, '?'), *kv, *val, *save;
+    int d;
+
+    if (!q)
+	return;
+    for (kv = strtok_r(q + 1, "&", &save); kv; kv = strtok_r(NULL, "&", &save)) {
+	if (!(val = strchr(kv, '=')))
+	    continue;
+	*val++ = '\0';
+	urldecode(val);
+	if (!strcmp(kv, "size"))
+	    sp->size = atol(val);
+	else if (!strcmp(kv, "delay"))
+	    sp->delay = atol(val);
+	else if (!strcmp(kv, "dist") && (d = parse_dist(val)) >= 0)
+	    sp->dist = d;
+	else if (!strcmp(kv, "bw"))
+	    sp->bw = atol(val);
+	else if (!strcmp(kv, "chunked"))
+	    sp->chunked = atoi(val);
+	else if (!strcmp(kv, "reset"))
+	    sp->reset = atol(val);
+	else if (!strcmp(kv, "cc"))
+	    snprintf(sp->cc, MAXLINE, "%s", val);
+	else if (!strcmp(kv, "etag"))
+	    snprintf(sp->etag, MAXLINE, "%s", val);
+	else if (!strcmp(kv, "status"))
+	    sp->status = atoi(val);
+    }
+}
+
+/* draw_delay - Sample a time to first byte, in ms, for shape sp */
+static long draw_delay(const shape_t *sp, unsigned int *seed)
+{
+    double u = (rand_r(seed) + 1.0) / ((double)RAND_MAX + 2);  /* (0,1) */
+
+    switch (sp->dist) {
+    case D_UNIFORM:
+	return 2 * sp->delay * u;
+    case D_EXP:
+	return -sp->delay * log(u);
+    case D_PARETO:   /* alpha 1.5, scale chosen for a mean of delay */
+	return sp->delay / 3.0 / pow(u, 1 / 1.5);
+    default:
+	return sp->delay;
+    }
+}
+
+static void sleep_us(long us)
+{
+    if (us > 0)
+	usleep(us);
+}
+
+/* reset_conn - Make the coming close() abort fd with a TCP RST */
+static void reset_conn(int fd)
+{
+    struct linger lg = { 1, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+/*
+ * send_body - Send sp->size pattern bytes, paced to sp->bw and cut off
+ *     after sp->reset. Returns -1 if the connection is no longer usable.
+ */
+static int send_body(int fd, const shape_t *sp)
+{
+    char buf[SENDCHUNK + 16], hdr[32];
+    long sent = 0, n, limit = sp->size;
+    unsigned long start = 0;
+    struct timeval tv;
+    int i;
+
+    if (sp->reset >= 0 && sp->reset < limit)
+	limit = sp->reset;
+    gettimeofday(&tv, NULL);
+    start = tv.tv_sec * 1000000UL + tv.tv_usec;
+
+    while (sent < limit) {
+	n = limit - sent < SENDCHUNK ? limit - sent : SENDCHUNK;
+	if (sp->bw > 0 && n > sp->bw / 100 + 1)
+	    n = sp->bw / 100 + 1;    /* ~10 ms of data per send */
+	for (i = 0; i < n; i++)
+	    buf[i] = 'a' + (sent + i) % 26;
+	if (sp->chunked) {
+	    snprintf(hdr, sizeof(hdr), "%lx\r\n", n);
+	    if (rio_sendn(fd, hdr, strlen(hdr)) < 0)
+		return -1;
+	    memcpy(buf + n, "\r\n", 2);
+	    if (rio_sendn(fd, buf, n + 2) < 0)
+		return -1;
+	}
+	else if (rio_sendn(fd, buf, n) < 0)
+	    return -1;
+	sent += n;
+	if (sp->bw > 0) {            /* Wait until we are back on pace */
+	    gettimeofday(&tv, NULL);
+	    sleep_us(start + sent * 1000000.0 / sp->bw -
+		     (tv.tv_sec * 1000000.0 + tv.tv_usec));
+	}
+    }
+    if (sent < sp->size) {
+	reset_conn(fd);
+	return -1;
+    }
+    if (sp->chunked && rio_sendn(fd, "0\r\n\r\n", 5) < 0)
+	return -1;
+    return 0;
+}
+
+/*
+ * serve - answer requests on fd until the client closes or asks to
+ *     close. Returns when the connection is done.
+ */
+static void serve(int fd, unsigned int *seed)
+{
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char name[MAXLINE], value[MAXLINE], inm[MAXLINE], hdrs[MAXBUF];
+    int persist, notmod;
+    size_t len;
+    shape_t shape;
+    rio_t rio;
+
+    rio_readinitb(&rio, fd);
+    do {
+	if (rio_readlineb(&rio, buf, MAXLINE) <= 0 ||
+	    parse_requestline(buf, method, uri, version) < 0)
+	    break;
+	persist = !strcmp(version, "HTTP/1.1");
+	inm[0] = '\0';
+	while (rio_readlineb(&rio, buf, MAXLINE) > 0 && strcmp(buf, "\r\n") &&
+	       strcmp(buf, "\n")) {
+	    if (parse_header(buf, name, value) < 0)
+		continue;
+	    if (!strcasecmp(name, "Connection"))
+		persist = strcasecmp(value, "close") &&
+		    (persist || !strcasecmp(value, "keep-alive"));
+	    else if (!strcasecmp(name, "If-None-Match"))
+		strcpy(inm, value);
+	}
+
+	shape = defaults;
+	parse_query(uri, &shape);
+	sleep_us(draw_delay(&shape, seed) * 1000);
+
+	notmod = shape.etag[0] && inm[0] && strstr(inm, shape.etag);
+	if (notmod)
+	    shape.status = 304;
+	len = snprintf(hdrs, MAXBUF, "HTTP/1.1 %d %s\r\n"
+		       "Server: origin\r\n"
+		       "Content-type: text/plain\r\n", shape.status,
+		       shape.status == 200 ? "OK" :
+		       shape.status == 304 ? "Not Modified" : "Synthetic");
+	if (shape.cc[0])
+	    len += snprintf(hdrs + len, MAXBUF - len, "Cache-Control: %s\r\n",
+			    shape.cc);
+	if (shape.etag[0])
+	    len += snprintf(hdrs + len, MAXBUF - len, "ETag: \"%s\"\r\n",
+			    shape.etag);
+	if (!notmod && shape.chunked)
+	    len += snprintf(hdrs + len, MAXBUF - len,
+			    "Transfer-Encoding: chunked\r\n");
+	else if (!notmod)
+	    len += snprintf(hdrs + len, MAXBUF - len, "Content-length: %ld\r\n",
+			    shape.size);
+	len += snprintf(hdrs + len, MAXBUF - len, "Connection: %s\r\n\r\n",
+			persist ? "keep-alive" : "close");
+	if (rio_sendn(fd, hdrs, len) < 0)
+	    break;
+	if (!notmod && strcasecmp(method, "HEAD") && send_body(fd, &shape) < 0)
+	    break;
+    } while (persist);
+    rio_readfreeb(&rio);
+}
+
+/* thread - Serve one connection, then close it */
+static void *thread(void *vargp)
+{
+    int fd = (int)(long)vargp, one = 1;
+    unsigned int seed = fd ^ (unsigned int)time(NULL) ^
+	(unsigned int)(unsigned long)pthread_self();
+
+    Pthread_detach(pthread_self());
+    /* Headers and body go out in separate sends; don't let Nagle
+       hold the body for the client's delayed ACK */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    serve(fd, &seed);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int listenfd, connfd, c;
+    pthread_t tid;
+
+    while ((c = getopt(argc, argv, "s:d:D:b:kr:c:e:")) != -1) {
+	switch (c) {
+	case 's': defaults.size = atol(optarg); break;
+	case 'd': defaults.delay = atol(optarg); break;
+	case 'D':
+	    if ((defaults.dist = parse_dist(optarg)) < 0)
+		usage(argv[0]);
+	    break;
+	case 'b': defaults.bw = atol(optarg); break;
+	case 'k': defaults.chunked = 1; break;
+	case 'r': defaults.reset = atol(optarg); break;
+	case 'c': snprintf(defaults.cc, MAXLINE, "%s", optarg); break;
+	case 'e': snprintf(defaults.etag, MAXLINE, "%s", optarg); break;
+	default: usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    listenfd = Open_listenfd(argv[optind]);
+    while (1) {
+	if ((connfd = accept(listenfd, NULL, NULL)) < 0)
+	    continue;
+	if (pthread_create(&tid, NULL, thread, (void *)(long)connfd) != 0)
+	    close(connfd);
+    }
+}
@@ -0,0 +1,245 @@
+/*
+ * replay - Re-issue a request trace captured by "proxy -t"
+ *
+ * usage: replay [-s speed] [-c max-inflight] <host:port> <trace>
+ *
+ * Requests are sent to host:port in the order they arrived, each on
+ * its own connection, at the trace's original pace scaled by speed
+ * (default 1; 2 replays twice as fast, 0 as fast as max-inflight
+ * allows). Each request is sent as captured, except that Connection,
+ * Proxy-Connection and Keep-Alive are replaced by "Connection: close"
+ * so that the end of a response is the end of its connection.
+ * Truncated requests are skipped.
+ *
+ * Latency is measured from when a request was due, not from when it
+ * could be sent, so a server that falls behind is charged for the
+ * backlog. Results are printed on stdout as JSON, including how many
+ * responses matched the traced status and size.
+ */
+#include "csapp.h"
+#include "http.h"
+#include "stats.h"
+#include "trace.h"
+
+#define MAXINFLIGHT 256
+
+/* A request to replay */
+typedef struct {
+    trace_rec_t rec;
+    char *req;                       /* Rewritten request text */
+    size_t len;
+    unsigned long due;               /* Send time, in stats_now() */
+} treq_t;
+
+static treq_t *reqs;
+static size_t nreqs, reqcap, skipped;
+
+static struct sockaddr_storage addr; /* Where to send */
+static socklen_t addrlen;
+static sem_t slots;                  /* Requests that may be in flight */
+
+/* Results, under mutex */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static hist_t hist;                  /* Latency, us */
+static unsigned long errors, bytes, status_same, size_same, maxlate;
+static unsigned long status[6];
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-s speed] [-c max-inflight] <host:port> "
+	    "<trace>\n", prog);
+    exit(1);
+}
+
+/* rewrite - Copy request text to dst, asking for the connection to close */
+static size_t rewrite(const char *src, char *dst)
+{
+    char line[MAXLINE], name[MAXLINE], value[MAXLINE];
+    const char *eol;
+    size_t len = 0, n;
+
+    for (; *src; src += n) {
+	eol = strchr(src, '\n');
+	n = eol ? eol - src + 1 : strlen(src);
+	if (n >= MAXLINE)
+	    n = MAXLINE - 1;
+	memcpy(line, src, n);
+	line[n] = '\0';
+	if (!strcmp(line, "\r\n") || !strcmp(line, "\n"))
+	    break;
+	if (len && parse_header(line, name, value) == 0 &&
+	    (!strcasecmp(name, "Connection") ||
+	     !strcasecmp(name, "Proxy-Connection") ||
+	     !strcasecmp(name, "Keep-Alive")))
+	    continue;
+	memcpy(dst + len, line, n);
+	len += n;
+    }
+    memcpy(dst + len, "Connection: close\r\n\r\n", 21);
+    return len + 21;
+}
+
+static int by_time(const void *a, const void *b)
+{
+    const treq_t *x = a, *y = b;
+
+    return x->rec.time_us < y->rec.time_us ? -1 :
+	x->rec.time_us > y->rec.time_us;
+}
+
+/* load_trace - Read every replayable request of file, in arrival order */
+static void load_trace(char *file)
+{
+    FILE *fp;
+    trace_rec_t rec;
+    char req[TRACE_MAXREQ + 1], buf[TRACE_MAXREQ + 32];
+    int rc, first;
+
+    if (!(fp = fopen(file, "r")))
+	unix_error("can't open trace");
+    for (first = 1; (rc = trace_read(fp, first, &rec, req)) > 0; first = 0) {
+	if ((rec.flags & TRACE_TRUNC) || rec.reqlen == 0) {
+	    skipped++;
+	    continue;
+	}
+	if (nreqs == reqcap) {
+	    reqcap = reqcap ? 2 * reqcap : 4096;
+	    reqs = Realloc(reqs, reqcap * sizeof(treq_t));
+	}
+	reqs[nreqs].rec = rec;
+	reqs[nreqs].len = rewrite(req, buf);
+	reqs[nreqs].req = Malloc(reqs[nreqs].len);
+	memcpy(reqs[nreqs].req, buf, reqs[nreqs].len);
+	nreqs++;
+    }
+    if (rc < 0) {
+	fprintf(stderr, "replay: %s is not a valid trace\n", file);
+	exit(1);
+    }
+    fclose(fp);
+    qsort(reqs, nreqs, sizeof(treq_t), by_time);
+}
+
+/* resolve - Look up the target host:port */
+static void resolve(char *target)
+{
+    struct addrinfo hints, *res;
+    char *colon = strrchr(target, ':');
+
+    if (!colon)
+	usage("replay");
+    *colon = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(target, colon + 1, &hints, &res) != 0) {
+	fprintf(stderr, "replay: can't resolve %s\n", target);
+	exit(1);
+    }
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
+/* thread - Send one request, read its response and account for it */
+static void *thread(void *vargp)
+{
+    treq_t *r = vargp;
+    char buf[MAXBUF];
+    size_t got = 0;
+    ssize_t n;
+    int fd, st = -1;
+    unsigned long latency;
+
+    Pthread_detach(pthread_self());
+    if ((fd = socket(addr.ss_family, SOCK_STREAM, 0)) >= 0) {
+	if (connect(fd, (SA *)&addr, addrlen) == 0 &&
+	    rio_sendn(fd, r->req, r->len) == r->len) {
+	    while ((n = read(fd, buf, MAXBUF)) > 0) {
+		if (got == 0)
+		    st = parse_status(buf, n);
+		got += n;
+	    }
+	    if (n < 0)
+		got = 0;
+	}
+	close(fd);
+    }
+    latency = stats_now() - r->due;
+
+    pthread_mutex_lock(&mutex);
+    if (got == 0)
+	errors++;
+    else {
+	hist_record(&hist, latency);
+	bytes += got;
+	status[st >= 100 && st < 600 ? st / 100 - 1 : 5]++;
+	status_same += st == r->rec.status;
+	size_same += got == r->rec.bytes;
+    }
+    pthread_mutex_unlock(&mutex);
+    V(&slots);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, maxinflight = MAXINFLIGHT;
+    double speed = 1, elapsed;
+    unsigned long begin, now;
+    uint64_t t0;
+    size_t k;
+    pthread_t tid;
+    static const char *classes[6] = { "1xx", "2xx", "3xx", "4xx", "5xx",
+				      "other" };
+
+    while ((c = getopt(argc, argv, "s:c:")) != -1) {
+	switch (c) {
+	case 's': speed = atof(optarg); break;
+	case 'c': maxinflight = atoi(optarg); break;
+	default: usage(argv[0]);
+	}
+    }
+    if (optind != argc - 2 || speed < 0 || maxinflight < 1)
+	usage(argv[0]);
+    resolve(argv[optind]);
+    load_trace(argv[optind + 1]);
+    signal(SIGPIPE, SIG_IGN);
+    Sem_init(&slots, 0, maxinflight);
+
+    begin = stats_now();
+    t0 = nreqs ? reqs[0].rec.time_us : 0;
+    for (k = 0; k < nreqs; k++) {
+	reqs[k].due = begin;
+	if (speed > 0)
+	    reqs[k].due += (reqs[k].rec.time_us - t0) / speed;
+	if ((now = stats_now()) < reqs[k].due)
+	    usleep(reqs[k].due - now);
+	P(&slots);
+	if ((now = stats_now()) > reqs[k].due && now - reqs[k].due > maxlate)
+	    maxlate = now - reqs[k].due;
+	if (speed == 0)
+	    reqs[k].due = now;
+	Pthread_create(&tid, NULL, thread, &reqs[k]);
+    }
+    for (i = 0; i < maxinflight; i++)   /* Wait for the stragglers */
+	P(&slots);
+    elapsed = (stats_now() - begin) / 1e6;
+
+    printf("{\n  \"speed\": %g, \"max_inflight\": %d, \"duration_s\": %.3f,\n",
+	   speed, maxinflight, elapsed);
+    printf("  \"requests\": %zu, \"skipped\": %zu, \"errors\": %lu, "
+	   "\"bytes\": %lu, \"max_late_us\": %lu,\n", nreqs, skipped, errors,
+	   bytes, maxlate);
+    printf("  \"status_match\": %lu, \"size_match\": %lu,\n", status_same,
+	   size_same);
+    printf("  \"status\": {");
+    for (c = 0; c < 6; c++)
+	printf("%s\"%s\": %lu", c ? ", " : "", classes[c], status[c]);
+    printf("},\n  \"latency_us\": {\"mean\": %lu, \"p50\": %lu, "
+	   "\"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}\n}\n",
+	   hist.total ? hist.sum / hist.total : 0,
+	   hist_percentile(&hist, 0.5), hist_percentile(&hist, 0.9),
+	   hist_percentile(&hist, 0.99), hist_percentile(&hist, 0.999),
+	   hist.max);
+    return 0;
+}
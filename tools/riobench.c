@@ -0,0 +1,353 @@
+/*
+ * riobench - Microbenchmarks for the Rio package and HTTP parsing
+ *
+ * usage: riobench [-t seconds] [filter]
+ *
+ * Times rio_readlineb, rio_readnb, rio_writen, parse_header, parse_uri
+ * and mime_type on clean, fragmented and large inputs, over
+ * socketpairs and in-memory files (memfd). Each benchmark repeats for
+ * at least -t seconds (default 0.2) and prints ns per operation and
+ * bytes per second. Only benchmarks whose name contains filter are run.
+ *
+ * Socketpair inputs are written by a second thread in pieces of a
+ * fixed size; small pieces make the reader see fragmented input.
+ */
+#include "csapp.h"
+#include <sys/syscall.h>
+#include "http.h"
+#include "mime.h"
+
+#define LINELEN   64                  /* Typical header line */
+#define HDRBYTES  (64 * 1024)         /* Header-like input size */
+#define BULKBYTES (16 * 1024 * 1024)  /* Bulk transfer size */
+
+static double mintime = 0.2;
+static char *filter;
+
+/* A socketpair feeder: writes buf to fd in pieces of frag bytes */
+typedef struct {
+    int fd;
+    const char *buf;
+    size_t len, frag;
+} feeder_t;
+
+static unsigned long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned long ops, size_t bytes,
+		   unsigned long ns)
+{
+    printf("%-36s %12.1f ns/op %10.1f MB/s\n", name, (double)ns / ops,
+	   bytes / (ns / 1e9) / 1e6);
+    fflush(stdout);
+}
+
+static int selected(const char *name)
+{
+    return !filter || strstr(name, filter);
+}
+
+/* make_lines - n bytes of "X-Hdr-N: vvvv...\r\n" lines of about len */
+static char *make_lines(size_t n, size_t len)
+{
+    char *buf = Malloc(n), line[MAXLINE];
+    size_t off = 0, k;
+    int i = 0;
+
+    while (off < n) {
+	k = snprintf(line, sizeof(line), "X-Hdr-%d: ", i++);
+	while (k < len - 2 && k < sizeof(line) - 3)
+	    line[k++] = 'v';
+	line[k++] = '\r';
+	line[k++] = '\n';
+	if (k > n - off)
+	    k = n - off;
+	memcpy(buf + off, line, k);
+	off += k;
+    }
+    buf[n - 1] = '\n';
+    return buf;
+}
+
+/* new_memfd - An empty in-memory file (csapp.h can't take _GNU_SOURCE) */
+static int new_memfd(void)
+{
+    int fd = syscall(SYS_memfd_create, "riobench", 0);
+
+    if (fd < 0)
+	unix_error("memfd_create");
+    return fd;
+}
+
+/* make_memfd - An in-memory file holding buf */
+static int make_memfd(const char *buf, size_t n)
+{
+    int fd = new_memfd();
+
+    if (rio_writen(fd, (void *)buf, n) != n)
+	unix_error("memfd write");
+    return fd;
+}
+
+static void *feeder(void *vargp)
+{
+    feeder_t *f = vargp;
+    size_t off, n;
+
+    for (off = 0; off < f->len; off += n) {
+	n = f->len - off < f->frag ? f->len - off : f->frag;
+	if (rio_writen(f->fd, (void *)(f->buf + off), n) < 0)
+	    break;
+    }
+    close(f->fd);
+    return NULL;
+}
+
+/* start_feeder - A socket from which buf arrives in pieces of frag */
+static int start_feeder(pthread_t *tid, feeder_t *f, const char *buf,
+			size_t len, size_t frag)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	unix_error("socketpair");
+    f->fd = sv[1];
+    f->buf = buf;
+    f->len = len;
+    f->frag = frag;
+    Pthread_create(tid, NULL, feeder, f);
+    return sv[0];
+}
+
+static void *drainer(void *vargp)
+{
+    int fd = (int)(long)vargp;
+    char buf[65536];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+	;
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Rio readers. Each pass reads an entire input and returns the
+ * number of calls made.
+ */
+static unsigned long read_lines(int fd, size_t bufsize)
+{
+    char line[MAXLINE];
+    unsigned long ops = 0;
+    rio_t rio;
+
+    rio_readinitbsz(&rio, fd, bufsize);
+    while (rio_readlineb(&rio, line, MAXLINE) > 0)
+	ops++;
+    rio_readfreeb(&rio);
+    return ops;
+}
+
+static unsigned long read_blocks(int fd, size_t chunk)
+{
+    char *buf = Malloc(chunk);
+    unsigned long ops = 0;
+    rio_t rio;
+
+    rio_readinitb(&rio, fd);
+    while (rio_readnb(&rio, buf, chunk) > 0)
+	ops++;
+    rio_readfreeb(&rio);
+    Free(buf);
+    return ops;
+}
+
+/* bench_memfd - Read buf from a memfd with fn until mintime passes */
+static void bench_memfd(const char *name, const char *buf, size_t len,
+			unsigned long (*fn)(int, size_t), size_t arg)
+{
+    int fd;
+    unsigned long ops = 0, passes = 0, start;
+
+    if (!selected(name))
+	return;
+    fd = make_memfd(buf, len);
+    start = now_ns();
+    do {
+	lseek(fd, 0, SEEK_SET);
+	ops += fn(fd, arg);
+	passes++;
+    } while (now_ns() - start < mintime * 1e9);
+    report(name, ops, passes * len, now_ns() - start);
+    close(fd);
+}
+
+/* bench_sock - Read buf from a socketpair fed in pieces of frag */
+static void bench_sock(const char *name, const char *buf, size_t len,
+		       size_t frag, unsigned long (*fn)(int, size_t), size_t arg)
+{
+    int fd;
+    unsigned long ops = 0, passes = 0, start, elapsed = 0;
+    pthread_t tid;
+    feeder_t f;
+
+    if (!selected(name))
+	return;
+    do {
+	fd = start_feeder(&tid, &f, buf, len, frag);
+	start = now_ns();
+	ops += fn(fd, arg);
+	elapsed += now_ns() - start;
+	passes++;
+	Pthread_join(tid, NULL);
+	close(fd);
+    } while (elapsed < mintime * 1e9);
+    report(name, ops, passes * len, elapsed);
+}
+
+/* bench_writen - rio_writen len bytes in pieces of chunk to a sink */
+static void bench_writen(const char *name, const char *buf, size_t len,
+			 size_t chunk, int memfd)
+{
+    int fd, sv[2];
+    unsigned long ops = 0, passes = 0, start, elapsed = 0;
+    size_t off;
+    pthread_t tid;
+
+    if (!selected(name))
+	return;
+    do {
+	if (memfd)
+	    fd = new_memfd();
+	else {
+	    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		unix_error("socketpair");
+	    fd = sv[0];
+	    Pthread_create(&tid, NULL, drainer, (void *)(long)sv[1]);
+	}
+	start = now_ns();
+	for (off = 0; off < len; off += chunk, ops++)
+	    rio_writen(fd, (void *)(buf + off),
+		       len - off < chunk ? len - off : chunk);
+	elapsed += now_ns() - start;
+	passes++;
+	close(fd);
+	if (!memfd)
+	    Pthread_join(tid, NULL);
+    } while (elapsed < mintime * 1e9);
+    report(name, ops, passes * len, elapsed);
+}
+
+/* bench_parse - Call parse_header or parse_uri on input until mintime */
+static void bench_parse(const char *name, const char *input, int uri)
+{
+    static char a[MAXBUF], b[MAXBUF], c[MAXBUF];
+    unsigned long ops = 0, start, i;
+    size_t len = strlen(input);
+
+    if (!selected(name))
+	return;
+    start = now_ns();
+    do {
+	for (i = 0; i < 1000; i++) {
+	    if (uri)
+		parse_uri(input, a, b, c);
+	    else
+		parse_header(input, a, b);
+	}
+	ops += 1000;
+    } while (now_ns() - start < mintime * 1e9);
+    report(name, ops, ops * len, now_ns() - start);
+}
+
+/* bench_mime - Call mime_type on name until mintime */
+static void bench_mime(const char *name, const char *input)
+{
+    unsigned long ops = 0, start, i;
+    volatile const char *type;
+
+    if (!selected(name))
+	return;
+    start = now_ns();
+    do {
+	for (i = 0; i < 1000; i++)
+	    type = mime_type(input);
+	ops += 1000;
+    } while (now_ns() - start < mintime * 1e9);
+    (void)type;
+    report(name, ops, ops * strlen(input), now_ns() - start);
+}
+
+int main(int argc, char **argv)
+{
+    char *lines, *longlines, *bulk, *longhdr, *longuri, *spaces;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:")) != -1) {
+	if (c != 't') {
+	    fprintf(stderr, "usage: %s [-t seconds] [filter]\n", argv[0]);
+	    exit(1);
+	}
+	mintime = atof(optarg);
+    }
+    if (optind < argc)
+	filter = argv[optind];
+    signal(SIGPIPE, SIG_IGN);
+
+    lines = make_lines(HDRBYTES, LINELEN);
+    longlines = make_lines(HDRBYTES, MAXLINE - 1);
+    bulk = make_lines(BULKBYTES, 1024);
+
+    /* rio_readlineb */
+    bench_memfd("readlineb/memfd/clean", lines, HDRBYTES, read_lines,
+		RIO_BUFSIZE);
+    bench_memfd("readlineb/memfd/1k-buf", lines, HDRBYTES, read_lines, 1024);
+    bench_memfd("readlineb/memfd/long-lines", longlines, HDRBYTES,
+		read_lines, RIO_BUFSIZE);
+    bench_sock("readlineb/sock/clean", lines, HDRBYTES, HDRBYTES, read_lines,
+	       RIO_BUFSIZE);
+    bench_sock("readlineb/sock/frag-3", lines, HDRBYTES, 3, read_lines,
+	       RIO_BUFSIZE);
+
+    /* rio_readnb */
+    bench_memfd("readnb/memfd/8k", bulk, BULKBYTES, read_blocks, MAXBUF);
+    bench_memfd("readnb/memfd/64k", bulk, BULKBYTES, read_blocks, 65536);
+    bench_memfd("readnb/memfd/100", bulk, BULKBYTES, read_blocks, 100);
+    bench_sock("readnb/sock/8k", bulk, BULKBYTES, 65536, read_blocks, MAXBUF);
+    bench_sock("readnb/sock/frag-7", lines, HDRBYTES, 7, read_blocks, MAXBUF);
+
+    /* rio_writen */
+    bench_writen("writen/memfd/8k", bulk, BULKBYTES, MAXBUF, 1);
+    bench_writen("writen/sock/8k", bulk, BULKBYTES, MAXBUF, 0);
+    bench_writen("writen/sock/100", bulk, BULKBYTES / 16, 100, 0);
+
+    /* parse_header */
+    longhdr = Malloc(MAXLINE);
+    snprintf(longhdr, MAXLINE, "X-Long: %0*d\r\n", MAXLINE - 12, 0);
+    spaces = Malloc(MAXLINE);
+    snprintf(spaces, MAXLINE, "X-Spaces:%*s\r\n", MAXLINE - 12, "v");
+    bench_parse("parse_header/clean", "Content-Type: text/html\r\n", 0);
+    bench_parse("parse_header/long-value", longhdr, 0);
+    bench_parse("parse_header/leading-spaces", spaces, 0);
+    bench_parse("parse_header/no-colon", "X-Hdr-1 vvvvvvvvvvvvvvvv\r\n", 0);
+
+    /* parse_uri */
+    longuri = Malloc(MAXLINE);
+    snprintf(longuri, MAXLINE, "http://www.example.com:8080/%0*d",
+	     MAXLINE - 30, 0);
+    bench_parse("parse_uri/clean", "http://www.cmu.edu/hub/index.html", 1);
+    bench_parse("parse_uri/ipv6-port", "http://[2001:db8::1]:8080/x", 1);
+    bench_parse("parse_uri/long-path", longuri, 1);
+    bench_parse("parse_uri/bad-scheme", "ftp://www.cmu.edu/", 1);
+
+    /* mime_type */
+    bench_mime("mime_type/html", "./home.html");
+    bench_mime("mime_type/jpeg", "./images/photos/2024/holiday/IMG_0042.JPG");
+    bench_mime("mime_type/double-ext", "./a.html.bak");
+    bench_mime("mime_type/no-ext", "./README");
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * trace.c - Binary request trace for capture and replay
+ *
+ * A trace is TRACE_MAGIC followed by variable-length records, each a
+ * trace_rec_t and the request text it describes. Records are written
+ * when a request completes, so they are in completion order; readers
+ * that want arrival order sort on time_us.
+ *
+ * Records go through one large stdio buffer. Its lock keeps each
+ * record whole, a write costs a copy unless the buffer fills, and a
+ * flusher thread pushes the buffer to the file every TRACE_FLUSH_MS.
+ */
+#include "csapp.h"
+#include "trace.h"
+
+#define TRACE_BUFSIZE  (256 * 1024)  /* stdio buffer */
+#define TRACE_FLUSH_MS 1000          /* Flusher wakeup period */
+
+static FILE *tracefp;                /* NULL while tracing is off */
+
+/* trace_flusher - Thread routine: flush the trace periodically */
+static void *trace_flusher(void *vargp)
+{
+    Pthread_detach(pthread_self());
+    while (1) {
+	usleep(TRACE_FLUSH_MS * 1000);
+	fflush(tracefp);
+    }
+    return NULL;
+}
+
+/*
+ * trace_open - Start a new trace at path. Returns -1 if the file can't
+ *     be created.
+ */
+int trace_open(const char *path)
+{
+    FILE *fp;
+    pthread_t tid;
+
+    if (!(fp = fopen(path, "w")))
+	return -1;
+    setvbuf(fp, NULL, _IOFBF, TRACE_BUFSIZE);
+    if (fwrite(TRACE_MAGIC, TRACE_MAGICLEN, 1, fp) != 1 || fflush(fp) != 0) {
+	fclose(fp);
+	return -1;
+    }
+    tracefp = fp;
+    Pthread_create(&tid, NULL, trace_flusher, NULL);
+    return 0;
+}
+
+/* trace_enabled - Nonzero once trace_open() has succeeded */
+int trace_enabled(void)
+{
+    return tracefp != NULL;
+}
+
+/* trace_write - Append rec and its rec->reqlen bytes of request text */
+void trace_write(const trace_rec_t *rec, const char *req)
+{
+    flockfile(tracefp);
+    fwrite_unlocked(rec, sizeof(*rec), 1, tracefp);
+    fwrite_unlocked(req, 1, rec->reqlen, tracefp);
+    funlockfile(tracefp);
+}
+
+/*
+ * trace_read - Read the next record from fp into rec and its request
+ *     text, NUL-terminated, into req (TRACE_MAXREQ + 1 bytes). On the
+ *     caller's first read of fp, checks the magic first: fp may be a
+ *     pipe, whose offset can't say where it is. Returns 1 on success, 0 at the end of the trace and -1 if
+ *     it is not a valid trace.
+ */
+int trace_read(FILE *fp, int first, trace_rec_t *rec, char *req)
+{
+    char magic[TRACE_MAGICLEN];
+
+    if (first && (fread(magic, TRACE_MAGICLEN, 1, fp) != 1 ||
+		  memcmp(magic, TRACE_MAGIC, TRACE_MAGICLEN)))
+	return -1;
+    if (fread(rec, sizeof(*rec), 1, fp) != 1)
+	return 0;
+    if (rec->reqlen > TRACE_MAXREQ ||
+	fread(req, 1, rec->reqlen, fp) != rec->reqlen)
+	return -1;
+    req[rec->reqlen] = '\0';
+    return 1;
+}
@@ -0,0 +1,38 @@
+/*
+ * trace.h - Binary request trace for capture and replay
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include "csapp.h"
+
+#define TRACE_MAGIC    "PXTRACE1"    /* First 8 bytes of every trace */
+#define TRACE_MAGICLEN 8
+#define TRACE_MAXREQ   MAXBUF        /* Request bytes kept per record */
+
+/* Record flags */
+#define TRACE_HIT      0x01          /* Served from the cache */
+#define TRACE_TRUNC    0x02          /* Request text was truncated */
+
+/*
+ * One request, followed in the file by reqlen bytes of request text:
+ * the request line and headers exactly as the client sent them, up to
+ * and including the blank line. Host byte order.
+ */
+typedef struct {
+    uint64_t time_us;                /* Arrival, us since the epoch */
+    uint64_t bytes;                  /* Response bytes sent */
+    uint32_t total_us;               /* Arrival to completion */
+    uint32_t ttfb_us;                /* Origin first byte, 0 if none */
+    uint16_t status;                 /* Status sent, 0 if none */
+    uint16_t flags;                  /* TRACE_* */
+    uint32_t reqlen;                 /* Bytes of request text */
+} trace_rec_t;
+
+int trace_open(const char *path);
+int trace_enabled(void);
+void trace_write(const trace_rec_t *rec, const char *req);
+int trace_read(FILE *fp, int first, trace_rec_t *rec, char *req);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,163 @@
+/*
+ * twheel.c - Hierarchical timing wheel with O(1) insert and cancel
+ *
+ * Timers live in doubly linked slot lists on one of TW_LEVELS wheels of
+ * TW_SLOTS slots each. Wheel k holds timers due between TW_SLOTS^k and
+ * TW_SLOTS^(k+1) ticks from now, in the slot picked by bits
+ * [k*TW_BITS, (k+1)*TW_BITS) of their expiry. Whenever the finer wheel
+ * wraps, the next slot of the coarser one is cascaded down. A
+ * background thread advances the wheel every TW_TICK milliseconds.
+ *
+ * Expiry callbacks run on that thread with the wheel locked, so they
+ * must be short and must not call back into the wheel. In exchange,
+ * once twheel_del() returns the callback is neither running nor due to
+ * run, and whatever it refers to may safely be released.
+ */
+#include "csapp.h"
+#include "twheel.h"
+#include "lockprof.h"
+
+/* elapsed_ms - Milliseconds of wall time since the wheel was started */
+static unsigned long elapsed_ms(twheel_t *tw)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - tw->start.tv_sec) * 1000 +
+	(ts.tv_nsec - tw->start.tv_nsec) / 1000000;
+}
+
+/* link_timer - Put pending timer t in the slot matching its expiry */
+static void link_timer(twheel_t *tw, twtimer_t *t)
+{
+    unsigned long delta;
+    int level = 0;
+    twtimer_t *head;
+
+    if (t->expires < tw->now)
+	t->expires = tw->now;
+    delta = t->expires - tw->now;
+    while (level < TW_LEVELS - 1 && delta >= 1UL << (TW_BITS * (level + 1)))
+	level++;
+    if (delta >= 1UL << (TW_BITS * TW_LEVELS))  /* Beyond the top wheel */
+	t->expires = tw->now + (1UL << (TW_BITS * TW_LEVELS)) - 1;
+
+    head = &tw->slots[level][(t->expires >> (TW_BITS * level)) & TW_MASK];
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void unlink_timer(twtimer_t *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+/* cascade - Redistribute the timers of a coarse slot over finer wheels */
+static void cascade(twheel_t *tw, int level, int idx)
+{
+    twtimer_t *head = &tw->slots[level][idx], *t;
+
+    while ((t = head->next) != head) {
+	unlink_timer(t);
+	link_timer(tw, t);
+    }
+}
+
+/* tick - Process tick tw->now: cascade if needed and run what is due */
+static void tick(twheel_t *tw)
+{
+    int level, idx = tw->now & TW_MASK;
+    twtimer_t *head = &tw->slots[0][idx], *t;
+
+    for (level = TW_LEVELS - 1; level > 0; level--)
+	if ((tw->now & ((1UL << (TW_BITS * level)) - 1)) == 0)
+	    cascade(tw, level, (tw->now >> (TW_BITS * level)) & TW_MASK);
+
+    while ((t = head->next) != head) {
+	unlink_timer(t);
+	t->fn(t);
+    }
+    tw->now++;
+}
+
+/* twheel_thread - Advance the wheel in step with the monotonic clock */
+static void *twheel_thread(void *vargp)
+{
+    twheel_t *tw = vargp;
+    unsigned long target;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+	usleep(TW_TICK * 1000);
+	target = elapsed_ms(tw) / TW_TICK;
+	MUTEX_LOCK(&tw->mutex);
+	while (tw->now <= target)
+	    tick(tw);
+	MUTEX_UNLOCK(&tw->mutex);
+    }
+    return NULL;
+}
+
+/*
+ * twheel_init - Initialize an empty wheel and start its thread
+ */
+void twheel_init(twheel_t *tw)
+{
+    int level, idx;
+    pthread_t tid;
+
+    pthread_mutex_init(&tw->mutex, NULL);
+    for (level = 0; level < TW_LEVELS; level++)
+	for (idx = 0; idx < TW_SLOTS; idx++)
+	    tw->slots[level][idx].next = tw->slots[level][idx].prev =
+		&tw->slots[level][idx];
+    clock_gettime(CLOCK_MONOTONIC, &tw->start);
+    tw->now = 0;
+    Pthread_create(&tid, NULL, twheel_thread, tw);
+}
+
+/*
+ * twtimer_init - Prepare an idle timer that will call fn(t) on expiry
+ */
+void twtimer_init(twtimer_t *t, void (*fn)(twtimer_t *), void *arg)
+{
+    t->next = t->prev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+/*
+ * twheel_add - Arm t to expire ms milliseconds from now (rounded up to
+ *     a tick boundary), replacing any earlier deadline it had
+ */
+void twheel_add(twheel_t *tw, twtimer_t *t, unsigned int ms)
+{
+    unsigned long expires = (elapsed_ms(tw) + ms + TW_TICK - 1) / TW_TICK;
+
+    MUTEX_LOCK(&tw->mutex);
+    if (t->next)
+	unlink_timer(t);
+    t->expires = expires;
+    link_timer(tw, t);
+    MUTEX_UNLOCK(&tw->mutex);
+}
+
+/*
+ * twheel_del - Disarm t. Returns 1 if it was pending, 0 if it had
+ *     already expired or was never armed.
+ */
+int twheel_del(twheel_t *tw, twtimer_t *t)
+{
+    int pending;
+
+    MUTEX_LOCK(&tw->mutex);
+    if ((pending = t->next != NULL))
+	unlink_timer(t);
+    MUTEX_UNLOCK(&tw->mutex);
+    return pending;
+}
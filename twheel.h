@@ -0,0 +1,35 @@
+/*
+ * twheel.h - Hierarchical timing wheel with O(1) insert and cancel
+ */
+#ifndef __TWHEEL_H__
+#define __TWHEEL_H__
+
+#include "csapp.h"
+
+#define TW_TICK     10                  /* Milliseconds per tick */
+#define TW_LEVELS   4                   /* Wheels, finest first */
+#define TW_BITS     6
+#define TW_SLOTS    (1 << TW_BITS)      /* Slots per wheel */
+#define TW_MASK     (TW_SLOTS - 1)
+
+/* A timer. It is pending while linked into one of the wheel's slots */
+typedef struct twtimer {
+    struct twtimer *prev, *next;        /* Slot list; next is NULL if idle */
+    unsigned long expires;              /* Absolute expiry, in ticks */
+    void (*fn)(struct twtimer *);       /* Expiry callback */
+    void *arg;                          /* For use by fn */
+} twtimer_t;
+
+typedef struct {
+    pthread_mutex_t mutex;              /* Protects everything below */
+    unsigned long now;                  /* Next tick to be processed */
+    struct timespec start;              /* Wall time of tick 0 */
+    twtimer_t slots[TW_LEVELS][TW_SLOTS]; /* List sentinels */
+} twheel_t;
+
+void twheel_init(twheel_t *tw);
+void twtimer_init(twtimer_t *t, void (*fn)(twtimer_t *), void *arg);
+void twheel_add(twheel_t *tw, twtimer_t *t, unsigned int ms);
+int twheel_del(twheel_t *tw, twtimer_t *t);
+
+#endif /* __TWHEEL_H__ */